@@ -48,6 +48,38 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// optional compressed output (-z): build with -DFPL_USE_ZLIB and/or -DFPL_USE_ZSTD
+#ifdef FPL_USE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef FPL_USE_ZSTD
+#include <zstd.h>
+#endif
+
+// optional direct database output (-sqlite): build with -DFPL_USE_SQLITE
+#ifdef FPL_USE_SQLITE
+#include <sqlite3.h>
+#endif
+
+// shared-memory export (-shm): POSIX only (glibc < 2.34 also needs -lrt)
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 
 #define FPL_MAGIC_SIG { 0xE1, 0xA0, 0x9C, 0x91, 0xF8, 0x3C, 0x77, 0x42, 0x85, 0x2C, 0x3B, 0xCC, 0x14, 0x01, 0xD3, 0xF2 }
@@ -79,10 +111,290 @@ typedef struct {
 
 typedef struct {
 	int key;
-	char field_name[128];
-	char value[1024];
+	char *field_name;		// points into the string table
+	char *value;			// points into the string table
+	unsigned int value_ofz;	// string table offset of value (used as escape cache key)
 } FPL_TRACK_ATTRIB;
 
+// marks a missing string table offset (attribute not present)
+#define FPL_NO_OFZ	0xFFFFFFFF
+
+// sort limits
+#define SORT_KEY_MAX		1024				// max encoded key size per track
+#define SORT_STR_MAX		255					// max bytes of a string field used in the key
+#define SORT_MEM_DEFAULT	256					// default -sortmem budget, in MB
+
+// output buffer size
+#define OUTBUF_SZ			(4*1024*1024)
+
+// escape cache limits
+#define ESC_CACHE_MAXLEN	512					// strings longer than this (lyrics, etc.) bypass the cache
+#define ESC_CACHE_MAXMEM	(64*1024*1024)		// max bytes of escaped strings held by the cache
+#define ESC_ARENA_BLOCK		(256*1024)			// arena block size for escaped strings
+
+// escaped string cache entry, keyed by string table offset + escape mode
+typedef struct {
+	unsigned int ofz;	// string table offset (FPL_NO_OFZ = empty slot)
+	int          mode;	// escape mode (ESCMODE_*)
+	const char  *str;	// escaped string, stored in the cache arena
+} FPL_ESC_ENTRY;
+
+// decoded attribute value
+typedef struct {
+	long long value;	// track number, integer, or unix timestamp (TYPED_DATE)
+	long long days;		// TYPED_DATE: days since 1970-01-01
+	int       total;	// TYPED_NUMBER: "3/12" -> 12
+	int       disc;		// TYPED_NUMBER: "1.03" -> 1
+	bool      valid;	// the string could be parsed
+} FPL_TYPED;
+
+// decoded value cache entry, keyed by string table offset + TYPED_* kind
+typedef struct {
+	unsigned int ofz;	// string table offset (FPL_NO_OFZ = empty slot)
+	int          kind;
+	FPL_TYPED    val;
+} FPL_TYPED_ENTRY;
+
+// buffered output (all writes to the output file go through one large buffer)
+typedef struct {
+	FILE   *outfile;
+	char   *buf;
+	size_t  len;
+	size_t  cap;
+} FPL_OUTBUF;
+
+// output block handed to the compression pool
+typedef struct {
+	char   *inbuf;			// uncompressed block (a former output buffer)
+	size_t  inlen;
+	char   *zbuf;			// compressed block
+	size_t  zlen;
+	bool    done;			// set by the worker once zbuf is ready
+	bool    failed;
+} FPL_ZBLOCK;
+
+// bounded single-producer/single-consumer ring of fixed-size elements. the producer
+// fills the element at tail and publishes it; the consumer uses the element at head
+// in place and then releases it. either side waits when the ring is full/empty:
+// briefly spinning, then sleeping on cv until the other side moves
+typedef struct {
+	char                *data;
+	size_t               elemsz;
+	size_t               cap;		// power of 2
+	alignas(64) std::atomic<size_t> head;	// next element to consume
+	alignas(64) std::atomic<size_t> tail;	// next element to produce
+	std::atomic<int>         sleepers;	// threads blocked (or about to block) on cv
+	std::mutex               lock;
+	std::condition_variable  cv;
+} FPL_SPSC_RING;
+
+// .fplidx header; followed by track_count 32-bit record offsets
+typedef struct {
+	char               magic[8];		// FPLIDX_MAGIC
+	unsigned int       version;			// FPLIDX_VERSION
+	unsigned int       track_count;		// playlist track count
+	unsigned long long fpl_size;		// size of the indexed FPL file
+	long long          fpl_mtime;		// modification time of the indexed FPL file
+} FPL_IDX_HEADER;
+
+// pipeline stage 1 -> 2: one raw track record
+typedef struct {
+	int             status;			// PIPE_REC_*
+	int             tdex;			// playlist index
+	long            ofz;			// record offset in the FPL file
+	int             real_keys;
+	FPL_TRACK_CHUNK chunk;
+	unsigned int    keys[512];
+} FPL_PIPE_REC;
+
+// pipeline stage 2 -> 3: one full output buffer
+typedef struct {
+	char   *buf;
+	size_t  len;
+	bool    last;					// end of output
+} FPL_PIPE_BLOCK;
+
+// -remap rule (filename prefix substitution)
+typedef struct {
+	char from[512];
+	char to[512];
+	int  from_len;
+} FPL_REMAP_RULE;
+
+// string table offset -> offset map entry (FPL writer)
+typedef struct {
+	unsigned int key;	// FPL_NO_OFZ = empty slot
+	unsigned int val;
+} FPL_OFZ_MAP;
+
+// -where predicate program instruction (postfix order)
+typedef struct {
+	int    opcode;			// WHERE_OP_*
+	int    field;			// WHERE_FIELD_* (WHERE_OP_TEST only)
+	char   name[128];		// attribute name, for WHERE_FIELD_ATTRIB
+	int    cmp;				// WHERE_CMP_*
+	bool   numeric;			// literal is a number: compare numerically
+	double num;				// numeric literal
+	char   str[512];		// string literal
+	int    str_len;
+} FPL_WHERE_OP;
+
+// -sort key
+typedef struct {
+	char name[128];			// attribute name, for WHERE_FIELD_ATTRIB
+	int  field;				// WHERE_FIELD_*
+	bool numeric;			// encode as number rather than case-folded string
+	int  typed;				// TYPED_* kind of a numeric attribute, -1 for anything else
+	bool descending;
+} FPL_SORT_KEY;
+
+// header of an in-memory sort record; the binary key follows it
+typedef struct {
+	long           ofz;		// track record offset in the FPL file
+	unsigned short keylen;
+} FPL_SORT_REC;
+
+// spilled sort run being merged
+typedef struct {
+	FILE          *runfile;
+	unsigned char  key[SORT_KEY_MAX];
+	unsigned short keylen;
+	long long      ofz;
+} FPL_SORT_RUN;
+
+// FPL writer state: one per output playlist
+typedef struct {
+	char          filename[1024];	// output filename (split mode only)
+	char         *strtab;			// deduplicated string table
+	unsigned int  strtab_sz;
+	unsigned int  strtab_cap;
+	unsigned int *strhash;			// content hash -> new offset (FPL_NO_OFZ = empty)
+	unsigned int  strhash_sz;
+	unsigned int  strhash_used;
+	FPL_OFZ_MAP  *ofzmap;			// source string table offset -> new offset
+	unsigned int  ofzmap_sz;
+	unsigned int  ofzmap_used;
+	char         *recs;				// track records (chunk + key array), in output order
+	size_t        recs_sz;
+	size_t        recs_cap;
+	unsigned int  track_count;
+	unsigned int  split_ofz;		// split mode: value offset this writer was created for
+} FPL_WRITER;
+
+// row schema column (CSV, SQL & XML output)
+typedef struct {
+	const char *prefix;			// literal text written before the value
+	int         prefix_len;
+	int         source;			// COL_*
+	const char *name;			// attribute name, for COL_ATTRIB & COL_ALBUM_ARTIST
+	int         escape;			// ESCMODE_*, for string values
+	int         decimals;		// digits after the decimal point, for numeric values
+	const char *suffix;			// literal text written after the value
+	int         suffix_len;
+} FPL_COLUMN;
+
+// one track, as handed to a database backend (NULL strings and has_* == false are SQL NULLs)
+typedef struct {
+	const char  *filename;
+	unsigned int subsong;
+	const char  *title;
+	const char  *artist;
+	const char  *album_artist;
+	const char  *album;
+	const char  *genre;
+	const char  *date;
+	const char  *codec;
+	const char  *codec_profile;
+	double       duration;
+	unsigned int fsize;
+	long long    tracknumber, discnumber, timestamp, bitrate, samplerate;
+	bool         has_tracknumber, has_discnumber, has_timestamp, has_bitrate, has_samplerate;
+} FPL_DB_ROW;
+
+// database backend for direct output (OUTMODE_MYSQL slot); every function
+// prints its own error message and returns non-zero on failure
+typedef struct {
+	const char *name;
+	int  (*open)(const char *target);		// open/connect and create the table
+	int  (*begin)();						// start a transaction
+	int  (*insert)(const FPL_DB_ROW *row);
+	int  (*commit)();
+	int  (*create_indexes)();				// after the bulk load (-dbindex)
+	void (*close)();
+} FPL_DB_BACKEND;
+
+// -verify entry (strings are stored in verify_strs)
+typedef struct {
+	size_t       path;		// local path
+	size_t       name;		// playlist filename
+	unsigned int fsize;		// size recorded in the playlist
+	long long    actual;	// size on disk (-1 = missing)
+} FPL_VERIFY_ENTRY;
+
+// -dupes track (filename stored in dupe_strs)
+typedef struct {
+	unsigned long long name;		// normalized artist + title hash
+	double             duration;
+	int                group;		// first track of its group (dupe_list index, -1 = none)
+	size_t             fname;
+	unsigned int       codec_ofz;
+	unsigned int       bitrate;
+	unsigned int       fsize;
+} FPL_DUPE_ENTRY;
+
+// -shm segment header (offsets are in bytes from the start of the segment)
+typedef struct {
+	char               magic[8];		// FPLSHM_MAGIC, written last
+	unsigned int       version;			// FPLSHM_VERSION
+	unsigned int       track_size;		// sizeof(FPL_SHM_TRACK)
+	unsigned int       track_count;
+	unsigned int       attrib_count;
+	unsigned long long track_ofz;		// FPL_SHM_TRACK[track_count]
+	unsigned long long attrib_ofz;		// FPL_SHM_ATTRIB[attrib_count]
+	unsigned long long strings_ofz;		// string blob
+	unsigned long long strings_sz;
+	unsigned long long total_sz;		// size of the whole segment
+} FPL_SHM_HEADER;
+
+// -shm track table entry (string fields are offsets into the string blob)
+typedef struct {
+	unsigned int filename;
+	unsigned int subsong;
+	unsigned int fsize;
+	unsigned int attrib_first;		// index of the track's first FPL_SHM_ATTRIB
+	unsigned int attrib_count;
+	unsigned int primary_count;		// the first primary_count attributes are primary
+	double       duration;			// seconds
+	float        rpg_album;
+	float        rpg_track;
+	float        rpk_album;
+	float        rpk_track;
+	long long    timestamp;			// date, as a unix timestamp
+	unsigned int tracknumber;
+	unsigned int discnumber;
+	unsigned int bitrate;
+	unsigned int samplerate;
+	unsigned int typed;				// FPLSHM_HAS_* bits: which of the fields above are set
+	unsigned int reserved;
+} FPL_SHM_TRACK;
+
+// -shm attribute table entry
+typedef struct {
+	unsigned int name;		// string blob offset of the field name
+	unsigned int value;		// string blob offset of the value
+} FPL_SHM_ATTRIB;
+
+// the -shm layout is documented (README) and read by other programs: keep it fixed
+static_assert(sizeof(FPL_SHM_HEADER) == 64,"FPL_SHM_HEADER must be 64 bytes");
+static_assert(sizeof(FPL_SHM_TRACK) == 80,"FPL_SHM_TRACK must be 80 bytes");
+static_assert(sizeof(FPL_SHM_ATTRIB) == 8,"FPL_SHM_ATTRIB must be 8 bytes");
+
+// -sql_spec file line
+typedef struct {
+	char column[64];			// output column name
+	char field[128];			// attribute or track field it is filled from
+} FPL_SPEC_ENTRY;
+
 // output types
 enum {
 	OUTMODE_NULL=0,			// no output
@@ -91,18 +403,185 @@ enum {
 	OUTMODE_M3U=3,			// generates an m3u extended playlist (includes length, artist, and track title)
 	OUTMODE_M3U_NOEXT=4,	// traditional (non-extended) m3u playlist
 	OUTMODE_CSV=5,			// CSV output dump
-	OUTMODE_XML=6			// outputs XML in Rhythmbox-compatible format
+	OUTMODE_XML=6,			// outputs XML in Rhythmbox-compatible format
+	OUTMODE_FPL=7,			// writes a new foobar2000 FPL playlist
+	OUTMODE_JSON=8,			// newline-delimited JSON, one object per track
+	OUTMODE_EAV=9,			// long format: one (track, field, value) row per attribute
+	OUTMODE_VERIFY=10,		// checks that the referenced files exist and match fsize
+	OUTMODE_DUPES=11,		// groups tracks with matching artist/title and duration
+	OUTMODE_SHM=12			// publishes the playlist in a POSIX shared-memory segment
+};
+
+
+// -where program opcodes
+enum {
+	WHERE_OP_TEST=0,		// push result of a single comparison
+	WHERE_OP_AND=1,
+	WHERE_OP_OR=2,
+	WHERE_OP_NOT=3
+};
+
+#define WHERE_STACK_MAX		64				// -where evaluation stack slots
+
+// -where comparison fields
+enum {
+	WHERE_FIELD_ATTRIB=0,	// any primary or secondary attribute, by name
+	WHERE_FIELD_FILENAME,
+	WHERE_FIELD_DURATION,
+	WHERE_FIELD_FSIZE,
+	WHERE_FIELD_SUBSONG,
+	WHERE_FIELD_RPG_ALBUM,
+	WHERE_FIELD_RPG_TRACK,
+	WHERE_FIELD_RPK_ALBUM,
+	WHERE_FIELD_RPK_TRACK
+};
+
+// -where comparison operators
+enum {
+	WHERE_CMP_EQ=0,			// =, ==
+	WHERE_CMP_NE,			// !=
+	WHERE_CMP_LT,			// <
+	WHERE_CMP_LE,			// <=
+	WHERE_CMP_GT,			// >
+	WHERE_CMP_GE,			// >=
+	WHERE_CMP_CONTAINS,		// ~  (case-insensitive substring)
+	WHERE_CMP_PREFIX		// ^= (case-insensitive prefix)
+};
+
+
+// sidecar index (.fplidx) file signature and version
+#define FPLIDX_MAGIC		"FPLIDX\0\0"
+#define FPLIDX_VERSION		1
+
+// pipeline record status
+enum {
+	PIPE_REC_TRACK=0,		// record holds a track
+	PIPE_REC_END=1,			// no more tracks
+	PIPE_REC_ERROR=2,		// bad record (keys_dex out of range)
+	PIPE_REC_SHORT=3		// truncated record (key array cut off)
+};
+
+// pipeline ring sizes
+#define PIPE_REC_SLOTS		256				// track records between reader and decoder
+#define PIPE_OUT_SLOTS		4				// output buffers between decoder and writer
+#define SPSC_SPINS			100				// yields before a waiting ring side goes to sleep
+
+// output compression (-z)
+enum {
+	COMPRESS_NONE=0,
+	COMPRESS_GZIP=1,		// concatenated gzip members, one per block
+	COMPRESS_ZSTD=2			// multi-frame zstd stream, one frame per block
+};
+
+
+// escape modes
+enum {
+	ESCMODE_SQL=0,			// escape_str (SQL & CSV output)
+	ESCMODE_XML=1,			// xml_escape_str
+	ESCMODE_JSON=2,			// json_escape_str
+	ESCMODE_NONE=-1			// raw value (row schemas only)
+};
+
+// typed attribute decoders
+enum {
+	TYPED_NUMBER=0,			// track/disc number: "3", "03", "3/12", "1.03"
+	TYPED_DATE=1,			// ISO or partial date -> unix timestamp
+	TYPED_INT=2				// leading integer: bitrate, samplerate...
 };
 
+// row schema column sources
+enum {
+	COL_LITERAL=0,			// prefix & suffix text only
+	COL_ATTRIB,				// attribute, by name
+	COL_ALBUM_ARTIST,		// attribute, falling back to "artist" when shorter than 3 chars
+	COL_FILENAME,
+	COL_DURATION,
+	COL_FSIZE,
+	COL_SUBSONG,
+	COL_RPG_ALBUM,
+	COL_RPG_TRACK,
+	COL_RPK_ALBUM,
+	COL_RPK_TRACK,
+	COL_TRACKNUM,			// TYPED_NUMBER value, or the attribute string if it doesn't parse
+	COL_NUMBER,				// TYPED_NUMBER value (0 if missing)
+	COL_INT,				// TYPED_INT value (0 if missing)
+	COL_TIMESTAMP,			// TYPED_DATE unix timestamp (0 if missing)
+	COL_JULIAN,				// TYPED_DATE as a GDate julian day (0 if missing)
+	COL_DRIVE,				// drive letter of the filename (-windrive only)
+	COL_MOUNTPOINT,			// the two characters following file://
+	COL_SQL_TABLE			// -sql_file table name
+};
+
+#define VERIFY_THREADS		16				// -verify stat threads (I/O bound, so more than CPUs)
+#define VERIFY_CHUNK		64				// entries claimed by a -verify thread at a time
+
+#define DUPE_TOLERANCE		2.0				// -dupes default duration tolerance, in seconds
+
+#define FPLSHM_MAGIC		"FPLSHM1"		// 7 chars + NUL = 8 bytes
+#define FPLSHM_VERSION		1
+
+#define FPLSHM_HAS_TRACKNUMBER	0x01
+#define FPLSHM_HAS_DISCNUMBER	0x02
+#define FPLSHM_HAS_TIMESTAMP	0x04
+#define FPLSHM_HAS_BITRATE		0x08
+#define FPLSHM_HAS_SAMPLERATE	0x10
+
+#define DB_BATCH_DEFAULT	50000			// rows per transaction for database output
+
+#define SCHEMA_SCRATCH		1024			// escape buffer for values that bypass the escape cache
+
 
 // function declarations
 int display_help(char *prgname);
 
 char* get_attrib(char *astring, int listlen);
+unsigned int get_attrib_ofz(char *astring, int listlen);
 void escape_str(char *instr, char *outbuf, int outbufsz);
 void xml_escape_str(char *instr, char *outbuf, int outbufsz);
+void json_escape_str(char *instr, char *outbuf, int outbufsz);
+const char* escape_cached(unsigned int ofz, int mode, char *scratch, int scratchsz);
+const char* esc_attrib(char *astring, int listlen, int mode, char *scratch, int scratchsz);
+void esc_cache_free();
+const FPL_TYPED* typed_value(unsigned int ofz, int kind);
+const FPL_TYPED* typed_attrib(const char *astring, int listlen, int kind);
+void typed_cache_free();
+int load_remap(char *rmfile);
+int remap_path(char *path, int pathsz);
+int display_remap_help();
+int display_where_help();
+int where_compile(char *expr);
+bool where_eval(char *trackfile, int *listlen);
+int decode_attribs();
+int read_track(FILE *fplfile, int tdex);
+int process_track(FILE *outtie, long recofz, int tdex);
+int pipeline_run(FILE *fplfile, FILE *outtie, unsigned int first, unsigned int end, long recofz);
+int index_build(FILE *fplfile, char *fplname, unsigned int plsize, long recofz);
+long index_lookup(char *fplname, unsigned int plsize, unsigned int tdex);
+int skip_tracks(FILE *fplfile, unsigned int tdex, unsigned int count, long *recofz);
+int pipe_writer_start();
+void pipe_writer_finish();
+int lookup_field(const char *fname);
+int load_spec(char *spfile);
+int spec_compile();
+void spec_free();
+int display_spec_help();
+int sort_parse(char *keylist);
+int sort_add(long ofz, unsigned int tdex, char *trackfile, int listlen);
+int sort_output(FILE *fplfile, FILE *outtie);
 int fpl_strcmpi(const char *s1, const char *s2); // replacement for strcmpi
 
+int ob_init(FILE *outfile);
+void ob_flush();
+void ob_free();
+void ob_write(const char *data, size_t len);
+void ob_printf(const char *fmt, ...);
+int zpool_start();
+int zpool_finish();
+void ob_puts(const char *str);
+void ob_put_uint(unsigned long long val);
+void ob_put_fixed(double val, int decimals);
+void ob_put_json_str(const char *str);
+
 int null_output(FILE *outfile, char *trackfile, int listlen);
 int sqlfile_output(FILE *outfile, char *trackfile, int listlen);
 int mysql_output(FILE *outfile, char *trackfile, int listlen);
@@ -110,6 +589,19 @@ int m3u_output(FILE *outfile, char *trackfile, int listlen);
 int csv_output(FILE *outfile, char *trackfile, int listlen);
 int m3u_noext_output(FILE *outfile, char *trackfile, int listlen);
 int xml_output(FILE *outfile, char *trackfile, int listlen);
+int fpl_output(FILE *outfile, char *trackfile, int listlen);
+int json_output(FILE *outfile, char *trackfile, int listlen);
+int eav_output(FILE *outfile, char *trackfile, int listlen);
+int eav_open(char *outname);
+int eav_close();
+int verify_output(FILE *outfile, char *trackfile, int listlen);
+int dupes_output(FILE *outfile, char *trackfile, int listlen);
+int shm_output(FILE *outfile, char *trackfile, int listlen);
+
+FPL_WRITER* fplw_create();
+int fplw_add_track(FPL_WRITER *fplw, char *trackfile);
+int fplw_write(FPL_WRITER *fplw, FILE *outfile);
+void fplw_free(FPL_WRITER *fplw);
 
 
 // output format lookup table
@@ -124,6 +616,12 @@ struct {
 	{"m3u-noext",m3u_noext_output},
 	{"csv",csv_output},
 	{"xml",xml_output},
+	{"fpl",fpl_output},
+	{"json",json_output},
+	{"eav",eav_output},
+	{"verify",verify_output},
+	{"dupes",dupes_output},
+	{"shm",shm_output},
 	{NULL,NULL}
 };
 
@@ -135,6 +633,14 @@ bool option_windrive = false;
 bool opt_alb_only = false;
 bool opt_remap = false;
 bool opt_fslash = false;
+bool opt_split = false;
+bool opt_json_array = false;
+int  opt_compress = COMPRESS_NONE;
+bool opt_pipeline = false;
+bool opt_mkindex = false;
+unsigned int opt_offset = 0;	// -offset: first playlist entry to process
+int  opt_limit = -1;			// -limit: max playlist entries to process (-1 = all)
+int  opt_zlevel = -1;			// -1 = library default
 
 // opt_alb_only parameters
 char last_aa[512];
@@ -149,10 +655,127 @@ char mysql_pass[64];
 char sql_database[64] = "music_db";
 char sql_table[64] = "fplreader";
 char nullstring[2] = "\0";
+char split_field[128];			// -split attribute name
+char split_base[1024];			// -split output filename template
+bool fplw_failed = false;		// a track couldn't be added: no playlist is written
+
+// -sql_spec columns
+FPL_SPEC_ENTRY	   *spec_entries = NULL;	// spec file lines
+int					spec_entry_count = 0;
+FPL_COLUMN		   *spec_cols = NULL;		// compiled columns
+int					spec_count = 0;
+char			   *spec_header = NULL;		// CSV header line
+
+// direct database output
+FPL_DB_BACKEND	   *db_backend = NULL;
+int					db_batch = DB_BATCH_DEFAULT;
+int					db_pending = 0;			// rows in the open transaction
+unsigned int		db_rows = 0;
+bool				db_failed = false;
+bool				opt_dbindex = false;
+#ifdef FPL_USE_SQLITE
+extern FPL_DB_BACKEND sqlite_backend;
+#endif
+
+// long-format output: dictionary files and intern maps (string table offset -> id)
+FILE			   *eav_fieldfile = NULL;
+FILE			   *eav_valuefile = NULL;
+FILE			   *eav_trackfile = NULL;
+FPL_OFZ_MAP		   *eav_fields = NULL;
+unsigned int		eav_field_sz = 0;
+unsigned int		eav_field_used = 0;
+FPL_OFZ_MAP		   *eav_values = NULL;
+unsigned int		eav_value_sz = 0;
+unsigned int		eav_value_used = 0;
+char			   *eav_escbuf = NULL;		// escaped strings too long for the escape cache
+size_t				eav_escbuf_sz = 0;
+unsigned int		eav_track_id = 0;
+bool				eav_failed = false;
+
+// -verify state
+std::vector<FPL_VERIFY_ENTRY>	verify_list;
+std::vector<char>				verify_strs;
+unsigned int					verify_skipped = 0;	// entries that aren't file://
+int								verify_threads = VERIFY_THREADS;
+
+// -dupes state
+std::vector<FPL_DUPE_ENTRY>		dupe_list;
+std::vector<char>				dupe_strs;
+double							dupe_tolerance = DUPE_TOLERANCE;
+
+// -shm state
+std::vector<FPL_SHM_TRACK>		shm_tracks;
+std::vector<FPL_SHM_ATTRIB>		shm_attribs;
+std::vector<char>				shm_extra;		// filenames changed by -remap, appended after the string table
+char							shm_name[256];
+bool							shm_failed = false;
+
+// remap rules
+FPL_REMAP_RULE	   *remap_rules = NULL;
+int					remap_count = 0;
+
+// compiled -where program
+FPL_WHERE_OP	   *where_prog = NULL;
+int					where_count = 0;
+
+// -sort state
+FPL_SORT_KEY		sort_keys[16];
+int					sort_count = 0;
+size_t				sort_mem_budget = (size_t)SORT_MEM_DEFAULT * 1024 * 1024;
+char			   *sort_arena = NULL;		// sort records (FPL_SORT_REC + key)
+size_t				sort_arena_sz = 0;
+size_t				sort_arena_cap = 0;
+size_t			   *sort_idx = NULL;		// arena offsets of records, sorted in place
+size_t				sort_idx_count = 0;
+size_t				sort_idx_cap = 0;
+FILE			  **sort_runs = NULL;		// spilled sorted runs
+int					sort_run_count = 0;
 
 // track data
 FPL_TRACK_CHUNK		chunkrunner;
 FPL_TRACK_ATTRIB	trackrunner[256];
+unsigned int		keyrunner[512];		// raw key array of the current track
+int					real_keys;			// number of values in keyrunner
+
+// string table (primary data area)
+char			   *dataprime = NULL;
+unsigned int		data_sz = 0;
+
+// output buffer
+FPL_OUTBUF			outbuf;
+
+// compression pool: blocks are compressed by the workers and written by the
+// main thread in submission order
+std::mutex					zp_lock;
+std::condition_variable		zp_cv_work;		// signalled when a block is queued
+std::condition_variable		zp_cv_done;		// signalled when a block is compressed
+std::deque<FPL_ZBLOCK*>		zp_queue;		// blocks waiting for a worker
+std::deque<FPL_ZBLOCK*>		zp_inflight;	// all unwritten blocks, in output order
+std::vector<char*>			zp_freebufs;	// recycled output buffers
+std::vector<std::thread>	zp_workers;
+bool						zp_shutdown = false;
+bool						zp_failed = false;
+
+// pipelined mode (-pipeline)
+FPL_SPSC_RING				pipe_recs;		// reader -> decoder
+FPL_SPSC_RING				pipe_out;		// decoder -> writer
+FPL_PIPE_BLOCK			   *pipe_cur = NULL;	// output block being filled by the decoder
+std::thread					pipe_writer;
+char					   *pipe_saved_buf = NULL;	// regular output buffer, while the writer runs
+
+// escape cache (open-addressed hash table + arena for the escaped strings)
+FPL_ESC_ENTRY	   *esc_cache = NULL;
+unsigned int		esc_cache_sz = 0;		// table size (power of 2)
+unsigned int		esc_cache_used = 0;		// occupied slots
+size_t				esc_cache_mem = 0;		// bytes of escaped strings stored
+char			  **esc_arena = NULL;		// arena block list
+int					esc_arena_cnt = 0;
+size_t				esc_arena_pos = ESC_ARENA_BLOCK;	// fill position of current block
+
+// typed value cache (open-addressed hash table)
+FPL_TYPED_ENTRY	   *typed_cache = NULL;
+unsigned int		typed_cache_sz = 0;
+unsigned int		typed_cache_used = 0;
 
 // display syntax and version info
 int display_help(char *prgname) {
@@ -186,6 +809,16 @@ int display_help(char *prgname) {
 	printf("      table          Table to which each row will be inserted\n");
 	printf("or    database.table Same as above, but also specifies database name\n\n");
 
+	printf("-- Database output --\n");
+	printf("   Inserts the tracks straight into a database, through one prepared\n");
+	printf("   statement in large transactions\n\n");
+
+	printf("-sqlite              Write to the SQLite database output_file (the table\n");
+	printf("                     is created if it doesn't exist)\n");
+	printf("-dbtable <name>      Table name (default %s)\n",sql_table);
+	printf("-dbbatch <n>         Rows per transaction (default %i)\n",DB_BATCH_DEFAULT);
+	printf("-dbindex             Index artist, album_artist and album after loading\n\n");
+
 	printf("-- M3U output (extended & traditional) --\n");
 	printf("   Writes to output_file an M3U extended-type playlist, which also contains\n");
 	printf("   track duration, title, and artist (in addition to filename)\n\n");
@@ -199,6 +832,57 @@ int display_help(char *prgname) {
 	printf("-- XML output --\n");
 	printf("-xml                 Enable XML Output mode (Rhythmbox-compatible schema)\n\n");
 
+	printf("-- JSON output --\n");
+	printf("   One JSON object per track with every primary and secondary attribute\n\n");
+	printf("-json                Enable JSON Output mode (newline-delimited)\n");
+	printf("-json-array          Enable JSON Output mode, as a single JSON array\n\n");
+
+	printf("-- Long-format output --\n");
+	printf("   One track_id,field_id,value_id row per attribute of every track, with\n");
+	printf("   the field names, values and tracks in output_file.fields.csv,\n");
+	printf("   output_file.values.csv and output_file.tracks.csv\n\n");
+	printf("-eav                 Enable long-format (EAV) Output mode\n\n");
+
+	printf("-- File verification --\n");
+	printf("   Checks that every track's file exists and still has the recorded size,\n");
+	printf("   and lists the ones that don't (in output_file, or on the console)\n\n");
+	printf("-verify              Enable verification mode (use -remap to map the\n");
+	printf("                     playlist's paths to local ones)\n");
+	printf("-verifythreads <n>   Number of threads checking files (default %i)\n\n",VERIFY_THREADS);
+
+	printf("-- Duplicate detection --\n");
+	printf("   Lists groups of tracks with the same artist and title (ignoring case,\n");
+	printf("   punctuation and anything in brackets) and nearly the same duration\n\n");
+	printf("-dupes               Enable duplicate detection mode\n");
+	printf("-dupetol <seconds>   Largest duration difference within a group (default %.1f)\n\n",DUPE_TOLERANCE);
+
+	printf("-- Shared-memory export --\n");
+	printf("   Publishes the tracks, their attributes and the playlist's string table\n");
+	printf("   in a POSIX shared-memory segment with a fixed layout (see README)\n\n");
+	printf("-shm <name>          Enable shared-memory export to segment <name>\n\n");
+
+	printf("-- FPL output --\n");
+	printf("   Writes a new foobar2000 playlist containing the selected tracks\n\n");
+	printf("-fpl                 Enable FPL Output mode\n");
+	printf("-split <field>       Write one playlist per distinct value of attribute\n");
+	printf("                     <field>, named \"output_file - value.fpl\"\n\n");
+
+	printf("-- Compressed output --\n");
+	printf("-z <gzip|zstd>       Compress output_file in independent blocks on all CPUs\n");
+	printf("                     (gzip: concatenated members, zstd: multiple frames)\n");
+	printf("-zlevel <n>          Compression level\n\n");
+
+	printf("-- Paging --\n");
+	printf("-mkindex             Write a sidecar index (fpl_file.fplidx) holding the\n");
+	printf("                     offset of every track record\n");
+	printf("-offset <n>          Start at playlist entry n (0-based); uses the index\n");
+	printf("                     to seek directly when it is present and current\n");
+	printf("-limit <n>           Stop after n playlist entries\n\n");
+
+	printf("-- Pipelined execution --\n");
+	printf("-pipeline            Read, decode/format and write on three threads,\n");
+	printf("                     overlapping file I/O with parsing\n\n");
+
 	printf("-- Misc options --\n\n");
 
 	printf("-verbose             Enable verbose output to stdout\n");
@@ -206,15 +890,86 @@ int display_help(char *prgname) {
 	printf("-albonly             CSV: Output artist/album information ONLY\n");
 	printf("-fslash              Transform backslash (\\) to forwardslash (/)\n");
 
-	//printf("-remap <file>        Specify remap file. For more info, try -remap?\n");
-	//printf("                     remap option allows reformatting filepath info\n");
-	//printf("-remap?              Show help for remap function\n");
-	
-/*
+	printf("-remap <file>        Specify remap file. For more info, try -remap?\n");
+	printf("                     remap option allows reformatting filepath info\n");
+	printf("-remap?              Show help for remap function\n");
+	printf("-where <expr>        Only output tracks matching expression <expr>\n");
+	printf("-where?              Show help for filter expressions\n");
+	printf("-sort <key,key,...>  Output tracks sorted by the listed fields; prefix a\n");
+	printf("                     field with - for descending order\n");
+	printf("                     (example: -sort \"album artist,album,tracknumber\")\n");
+	printf("-sortmem <MB>        Memory budget for -sort before spilling to disk\n");
+	printf("                     (default %i)\n",SORT_MEM_DEFAULT);
 	printf("-sql_spec spfile     spfile contains SQL table field list\n");
 	printf("                     (type -specfile for more in-depth info)\n");
 	printf("-specfile            Show specfile formatting syntax and help\n");
-*/
+	printf("\n\n\n");
+
+	return 0;
+}
+
+// display -sql_spec file syntax
+int display_spec_help() {
+
+	printf("-- Spec files --\n");
+	printf("   A spec file replaces the built-in column list of -csv and -sql_file\n");
+	printf("   output. Each line names one output column and the field it is\n");
+	printf("   filled from:\n\n");
+	printf("     column_name  field\n\n");
+	printf("   field   any attribute name (title, \"album artist\", bitrate...),\n");
+	printf("           or one of: filename, duration, fsize, subsong,\n");
+	printf("           rg_album, rg_track, rpk_album, rpk_track\n\n");
+	printf("   Attributes and filename are written as quoted, escaped strings, the\n");
+	printf("   other fields as numbers. An attribute can be decoded into a number\n");
+	printf("   by appending one of:\n\n");
+	printf("     :number      track/disc number (\"03\", \"3/12\" and \"1.03\" give 3)\n");
+	printf("     :int         leading integer (bitrate, samplerate...)\n");
+	printf("     :timestamp   date as a unix timestamp (\"2004\", \"2004-05-06\"...)\n\n");
+	printf("   Missing or unparsable values are written as 0.\n");
+	printf("   SQL output names the columns in each INSERT.\n");
+	printf("   Blank lines and lines starting with # are ignored. Example:\n\n");
+	printf("     path     filename\n");
+	printf("     title    title\n");
+	printf("     artist   \"album artist\"\n");
+	printf("     track    tracknumber:number\n");
+	printf("     released date:timestamp\n");
+	printf("     length   duration\n");
+	printf("\n\n\n");
+
+	return 0;
+}
+
+// display -where expression syntax
+int display_where_help() {
+
+	printf("-- Filter expressions --\n");
+	printf("   -where takes a single argument (quote it in your shell) made of\n");
+	printf("   comparisons joined with and/or/not (or &&, ||, !) and parentheses:\n\n");
+	printf("     field op value\n\n");
+	printf("   field   any attribute name (genre, artist, \"album artist\", bitrate...),\n");
+	printf("           or one of: filename, duration, fsize, subsong,\n");
+	printf("           rg_album, rg_track, rpk_album, rpk_track\n");
+	printf("   op      =  !=  <  <=  >  >=  ~ (contains)  ^= (starts with)\n");
+	printf("   value   number, word, or quoted string\n\n");
+	printf("   Numeric values compare numerically; strings compare case-insensitively.\n");
+	printf("   Examples:\n\n");
+	printf("     \"genre = Jazz and duration > 600\"\n");
+	printf("     \"bitrate < 192 or filename ^= 'file://D:\\Incoming'\"\n");
+	printf("\n\n\n");
+
+	return 0;
+}
+
+// display remap file syntax
+int display_remap_help() {
+
+	printf("-- Remap files --\n");
+	printf("   A remap file rewrites the beginning of each track's filename before it\n");
+	printf("   is written to any output. Each line holds one rule:\n\n");
+	printf("     old_prefix|new_prefix\n\n");
+	printf("   Prefixes are matched case-insensitively and the first matching rule wins.\n");
+	printf("   Blank lines and lines starting with # are ignored. Example:\n\n");
+	printf("     file://C:\\Music\\|file:///mnt/music/\n");
 	printf("\n\n\n");
 
 	return 0;
@@ -246,46 +1001,11 @@ int main(int argc, char **argv) {
 
 	// enumerate arguments and flags
 	for(int i = 1; i < argc; i++) {
-		// enable mysql output		
+		// direct mysql output: fail before taking its arguments, so it can't be
+		// mistaken for (or silently overridden by) -sqlite
 		if(!strcmp("-mysql",argv[i])) {
-			outmode = OUTMODE_MYSQL;
-			if(argc < (i+4)) {
-				printf("error: incorrect syntax. switch -mysql requires 3 arguments!\n\n");
-				display_help(argv[0]);
-				return 200;
-			} else if(fnstatus < 1) {
-				printf("error: incorrect syntax. input filename must come before this option!\n\n");
-				display_help(argv[0]);
-				return 200;
-			}
-
-			// get arguments
-
-			// hostname & port <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< fix
-			if(argv[i+1][0] == '-') {
-				printf("error: incorrect syntax. switch -mysql requires 3 arguments!\n\n");
-				display_help(argv[0]);
-				return 200;
-			}
-			strcpy(mysql_host,argv[i+1]);
-
-			// database & table <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< fix
-			if(argv[i+2][0] == '-') {
-				printf("error: incorrect syntax. switch -mysql requires 3 arguments!\n\n");
-				display_help(argv[0]);
-				return 200;
-			}
-			strcpy(sql_database,argv[i+2]);
-
-			// username & password <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< fix
-			if(argv[i+3][0] == '-') {
-				printf("error: incorrect syntax. switch -mysql requires 3 arguments!\n\n");
-				display_help(argv[0]);
-				return 200;
-			}
-			strcpy(mysql_user,argv[i+3]);
-
-			i += 3; // account for this flag's 3 arguments
+			printf("error: direct MySQL output is not implemented yet (try -sqlite)!\n\n");
+			return 200;
 
 		// enable sql file output		
 		} else if(!strcmp("-sql_file",argv[i])) {
@@ -312,6 +1032,37 @@ int main(int argc, char **argv) {
 
 			i++; // account for this flag's argument
 
+		// direct SQLite database output
+		} else if(!strcmp("-sqlite",argv[i])) {
+#ifdef FPL_USE_SQLITE
+			outmode = OUTMODE_MYSQL;
+			db_backend = &sqlite_backend;
+#else
+			printf("error: SQLite output is not available (rebuild with -DFPL_USE_SQLITE -lsqlite3)\n\n");
+			return 200;
+#endif
+
+		} else if(!strcmp("-dbtable",argv[i])) {
+			if(argc < (i+2) || argv[i+1][0] == '-' || strlen(argv[i+1]) >= sizeof(sql_table)) {
+				printf("error: incorrect syntax. switch -dbtable requires a table name!\n\n");
+				display_help(argv[0]);
+				return 200;
+			}
+			strcpy(sql_table,argv[i+1]);
+			i++;
+
+		} else if(!strcmp("-dbbatch",argv[i])) {
+			if(argc < (i+2) || atoi(argv[i+1]) < 1) {
+				printf("error: incorrect syntax. switch -dbbatch requires a row count!\n\n");
+				display_help(argv[0]);
+				return 200;
+			}
+			db_batch = atoi(argv[i+1]);
+			i++;
+
+		} else if(!strcmp("-dbindex",argv[i])) {
+			opt_dbindex = true;
+
 		// enable extended M3U playlist output
 		} else if(!strcmp("-m3u",argv[i])) {
 			outmode = OUTMODE_M3U;
@@ -327,7 +1078,193 @@ int main(int argc, char **argv) {
                 // enable XML output
                 } else if(!strcmp("-xml",argv[i])) {
                         outmode = OUTMODE_XML;
+
+		// enable JSON output
+		} else if(!strcmp("-json",argv[i])) {
+			outmode = OUTMODE_JSON;
+
+		} else if(!strcmp("-json-array",argv[i])) {
+			outmode = OUTMODE_JSON;
+			opt_json_array = true;
+
+		// enable long-format (EAV) output
+		} else if(!strcmp("-eav",argv[i])) {
+			outmode = OUTMODE_EAV;
+
+		// check the referenced files on disk
+		} else if(!strcmp("-verify",argv[i])) {
+			outmode = OUTMODE_VERIFY;
+
+		} else if(!strcmp("-verifythreads",argv[i])) {
+			if(argc < (i+2) || atoi(argv[i+1]) < 1) {
+				printf("error: incorrect syntax. switch -verifythreads requires a thread count!\n\n");
+				display_help(argv[0]);
+				return 200;
+			}
+			verify_threads = atoi(argv[i+1]);
+			i++;
+
+		// fuzzy duplicate detection
+		} else if(!strcmp("-dupes",argv[i])) {
+			outmode = OUTMODE_DUPES;
+
+		} else if(!strcmp("-dupetol",argv[i])) {
+			if(argc < (i+2) || atof(argv[i+1]) <= 0.0) {
+				printf("error: incorrect syntax. switch -dupetol requires a number of seconds!\n\n");
+				display_help(argv[0]);
+				return 200;
+			}
+			dupe_tolerance = atof(argv[i+1]);
+			i++;
+
+		// shared-memory export
+		} else if(!strcmp("-shm",argv[i])) {
+#ifdef _WIN32
+			printf("error: -shm is not available on this platform!\n\n");
+			return 200;
+#else
+			if(argc < (i+2) || argv[i+1][0] == '-' || strlen(argv[i+1]) > 250) {
+				printf("error: incorrect syntax. switch -shm requires a segment name!\n\n");
+				display_help(argv[0]);
+				return 200;
+			}
+			outmode = OUTMODE_SHM;
+			sprintf(shm_name,"%s%s",(argv[i+1][0] == '/') ? "" : "/",argv[i+1]);
+			i++;
+#endif
+
+		// enable FPL playlist output
+		} else if(!strcmp("-fpl",argv[i])) {
+			outmode = OUTMODE_FPL;
+
+		// split FPL output by attribute value
+		} else if(!strcmp("-split",argv[i])) {
+			if(argc < (i+2) || argv[i+1][0] == '-') {
+				printf("error: incorrect syntax. switch -split requires an argument!\n\n");
+				display_help(argv[0]);
+				return 200;
+			}
+			strncpy(split_field,argv[i+1],sizeof(split_field) - 1);
+			opt_split = true;
+			i++;
+
+		// load filename remap rules
+		} else if(!strcmp("-remap",argv[i])) {
+			if(argc < (i+2)) {
+				printf("error: incorrect syntax. switch -remap requires an argument!\n\n");
+				display_help(argv[0]);
+				return 200;
+			}
+			if(load_remap(argv[i+1])) return 200;
+			opt_remap = true;
+			i++;
+
+		} else if(!strcmp("-remap?",argv[i])) {
+			display_remap_help();
+			return 1;
+
+		// track filter expression
+		} else if(!strcmp("-where",argv[i])) {
+			if(argc < (i+2)) {
+				printf("error: incorrect syntax. switch -where requires an argument!\n\n");
+				display_help(argv[0]);
+				return 200;
+			}
+			if(where_compile(argv[i+1])) return 200;
+			i++;
+
+		} else if(!strcmp("-where?",argv[i])) {
+			display_where_help();
+			return 1;
+
+		// user-defined column list
+		} else if(!strcmp("-sql_spec",argv[i])) {
+			if(argc < (i+2)) {
+				printf("error: incorrect syntax. switch -sql_spec requires an argument!\n\n");
+				display_help(argv[0]);
+				return 200;
+			}
+			if(load_spec(argv[i+1])) return 200;
+			i++;
+
+		} else if(!strcmp("-specfile",argv[i])) {
+			display_spec_help();
+			return 1;
+
+		// sorted output
+		} else if(!strcmp("-sort",argv[i])) {
+			if(argc < (i+2)) {
+				printf("error: incorrect syntax. switch -sort requires an argument!\n\n");
+				display_help(argv[0]);
+				return 200;
+			}
+			if(sort_parse(argv[i+1])) return 200;
+			i++;
+
+		} else if(!strcmp("-sortmem",argv[i])) {
+			if(argc < (i+2) || atoi(argv[i+1]) < 1) {
+				printf("error: incorrect syntax. switch -sortmem requires a size in MB!\n\n");
+				display_help(argv[0]);
+				return 200;
+			}
+			sort_mem_budget = (size_t)atoi(argv[i+1]) * 1024 * 1024;
+			i++;
 		
+		// compressed output
+		} else if(!strcmp("-z",argv[i])) {
+			if(argc < (i+2)) {
+				printf("error: incorrect syntax. switch -z requires an argument!\n\n");
+				display_help(argv[0]);
+				return 200;
+			}
+			if(!strcmp(argv[i+1],"gzip")) {
+#ifdef FPL_USE_ZLIB
+				opt_compress = COMPRESS_GZIP;
+#else
+				printf("error: gzip output is not available (rebuild with -DFPL_USE_ZLIB -lz)\n\n");
+				return 200;
+#endif
+			} else if(!strcmp(argv[i+1],"zstd")) {
+#ifdef FPL_USE_ZSTD
+				opt_compress = COMPRESS_ZSTD;
+#else
+				printf("error: zstd output is not available (rebuild with -DFPL_USE_ZSTD -lzstd)\n\n");
+				return 200;
+#endif
+			} else {
+				printf("error: incorrect syntax. switch -z takes gzip or zstd!\n\n");
+				display_help(argv[0]);
+				return 200;
+			}
+			i++;
+
+		} else if(!strcmp("-zlevel",argv[i])) {
+			if(argc < (i+2)) {
+				printf("error: incorrect syntax. switch -zlevel requires an argument!\n\n");
+				display_help(argv[0]);
+				return 200;
+			}
+			opt_zlevel = atoi(argv[i+1]);
+			i++;
+
+		// sidecar index & paging
+		} else if(!strcmp("-mkindex",argv[i])) {
+			opt_mkindex = true;
+
+		} else if(!strcmp("-offset",argv[i]) || !strcmp("-limit",argv[i])) {
+			if(argc < (i+2) || argv[i+1][0] < '0' || argv[i+1][0] > '9') {
+				printf("error: incorrect syntax. switch %s requires a number!\n\n",argv[i]);
+				display_help(argv[0]);
+				return 200;
+			}
+			if(argv[i][1] == 'o') opt_offset = (unsigned int)strtoul(argv[i+1],NULL,10);
+			else                  opt_limit  = atoi(argv[i+1]);
+			i++;
+
+		// three-stage pipelined execution
+		} else if(!strcmp("-pipeline",argv[i])) {
+			opt_pipeline = true;
+
 		// transform all slashes to forwardslash
                 } else if(!strcmp("-fslash",argv[i])) {
                         opt_fslash = true;
@@ -366,8 +1303,49 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	if(opt_split) {
+		if(outmode != OUTMODE_FPL) {
+			printf("error: -split can only be used with -fpl output!\n\n");
+			return 200;
+		} else if(outfile[0] == NULL) {
+			printf("error: -split requires an output filename!\n\n");
+			return 200;
+		}
+		// split playlists are written by the FPL writer itself
+		strcpy(split_base,outfile);
+		outfile[0] = NULL;
+	}
+
+	if(opt_compress && outfile[0] == NULL) {
+		printf("error: -z requires an output filename (and can't be combined with -split)!\n\n");
+		return 200;
+	}
+
+	if(spec_entry_count && spec_compile()) return 200;
+
+	if(outmode == OUTMODE_EAV && outfile[0] == NULL) {
+		printf("error: -eav requires an output filename!\n\n");
+		return 200;
+	}
+
+	// database output writes to output_file through the backend, not a FILE
+	char dbfile[1024];
+	dbfile[0] = NULL;
+	if(outmode == OUTMODE_MYSQL) {
+		if(outfile[0] == NULL || opt_compress) {
+			printf("error: %s output requires an output filename (and can't be combined with -z)!\n\n",db_backend->name);
+			return 200;
+		}
+		strcpy(dbfile,outfile);
+		outfile[0] = NULL;
+	}
+
 	if(verbose) {
 		printf("Verbose output mode enabled.\n");
+		if(opt_remap) printf("opt_remap enabled. %i filename remap rules loaded.\n",remap_count);
+		if(where_count) printf("-where filter compiled to %i instructions.\n",where_count);
+		if(spec_count) printf("-sql_spec compiled to %i columns.\n",spec_count);
+		if(sort_count) printf("-sort enabled with %i keys, %u MB memory budget.\n",sort_count,(unsigned int)(sort_mem_budget / (1024*1024)));
 		if(opt_alb_only) printf("opt_alb_only enabled. Outputting only unique albums.\n");
 		if(option_windrive) printf("option_windrive enabled. Outputting drive letter to option1 field.\n");
 		printf("\n");
@@ -387,12 +1365,38 @@ int main(int argc, char **argv) {
 
 	if(outfile[0] != NULL) {
 		printf("Opening output file \"%s\"\n",outfile);
-		if((outtie = fopen(outfile,"w")) == NULL) {
+		if((outtie = fopen(outfile,(outmode == OUTMODE_FPL || opt_compress) ? "wb" : "w")) == NULL) {
 			printf("Unable to open file for writing!\n\n");
 			return 255;
 		}
 	}
 
+	if(outmode == OUTMODE_EAV && eav_open(outfile)) return 255;
+
+	if(db_backend) {
+		printf("Opening %s database \"%s\"\n",db_backend->name,dbfile);
+		if(db_backend->open(dbfile)) {
+			printf("Unable to open database for writing!\n\n");
+			return 255;
+		}
+	}
+
+	if(ob_init(outtie)) {
+		printf("error allocating memory for output buffer!\n");
+		return 254;
+	}
+
+	if(opt_compress && zpool_start()) {
+		printf("error starting compression threads!\n");
+		return 254;
+	}
+
+	// with -z, the compression pool takes the place of the writer stage
+	if(opt_pipeline && outtie && !opt_compress && pipe_writer_start()) {
+		printf("error starting pipeline writer thread!\n");
+		return 254;
+	}
+
 	printf("Parsing & Writing...\n\n");
 	
 	// read 16-byte signature
@@ -400,15 +1404,12 @@ int main(int argc, char **argv) {
 	fread(magicsig,16,1,fplfile);
 
 	// load primary data string into memory
-	unsigned int data_sz;
 	fread(&data_sz,4,1,fplfile);
 
 	if(verbose) printf("size of primary data area = %i bytes\n",data_sz);
 
 	if(verbose) printf("allocating memory for data area...\n");
 
-	char *dataprime;
-
 	if((dataprime = (char*)malloc(data_sz)) == NULL) {
 		printf("error allocating memory for primary data area! (%i bytes)\n",data_sz);
 		fclose(fplfile);
@@ -428,138 +1429,96 @@ int main(int argc, char **argv) {
 
 	// entering chunk reader loop...
 
-	unsigned int		keyrunner[512];
-	fpos_t				fploffset;
-	int					krn_bytes = 0;
-	double				duration_conv;
-	int					real_keys;
-	int					attrib_count = 0;
-	int					trx_dex = 0;
-	char				tdata_fname[1024];
-
-	for(int i = 0; i < plsize && !feof(fplfile); i++) {
-		fgetpos(fplfile, &fploffset);
-		if(verbose) printf("trackrunner: Reading track info at: index < %i > / start offset < 0x%08X >...\n",i,fploffset);
-		
-		fread((void*)&chunkrunner,sizeof(FPL_TRACK_CHUNK),1,fplfile);
-		fgetpos(fplfile, &fploffset);
-		if(verbose) printf("\ttrackrunner: done. ending offset < 0x%08X >.\n",fploffset);
-
-		// display chunkrunner results
-
-		// tricky casting! MSVC won't let us do a char to double cast... so we'll show him who's boss...
-		memcpy((void*)&duration_conv,chunkrunner.duration_dbl,8);
-
-
-		if(verbose) {
-			printf("\tchunkrunner:\n");
-			printf("\t  unk1 = %i\n",chunkrunner.unk1);
-			printf("\t  String table offset = %i\n",chunkrunner.file_ofz);
-			printf("\t  Subsong index = %i\n",chunkrunner.subsong);
-			printf("\t  Track filesize = %i bytes\n",chunkrunner.fsize);
-			printf("\t  unk2 = %i  [ 0x%08X ]\n",chunkrunner.unk2,chunkrunner.unk2);
-			printf("\t  unk3 = %i  [ 0x%08X ]\n",chunkrunner.unk3,chunkrunner.unk3);
-			printf("\t  unk4 = %i  [ 0x%08X ]\n",chunkrunner.unk4,chunkrunner.unk4);
-			printf("\t  Track duration = %0.02f seconds\n",duration_conv);
-			printf("\t  ReplayGain, album = %0.02f dB\n",chunkrunner.rpg_album);
-			printf("\t  ReplayGain, track = %0.02f dB\n",chunkrunner.rpg_track);
-			printf("\t  ReplayGain, album peak = %0.02f dB\n",chunkrunner.rpk_album);
-			printf("\t  ReplayGain, track peak = %0.02f dB\n",chunkrunner.rpk_track);
-			printf("\t  --------------\n");
-			printf("\t  keys_dex = %i, key_primary = %i, key_second = %i, key_sec_offset = %i\n\n",chunkrunner.keys_dex,chunkrunner.key_primary,chunkrunner.key_second,chunkrunner.key_sec_offset);
-		}
-
-		// attribute count is primary keys (key_primary) + secondary keys (key_second)
-		attrib_count = chunkrunner.key_primary + chunkrunner.key_second;
-		if(verbose) printf("\ttrackrunner determined this track has %i attribute fields.\n",attrib_count);
-		
-		// keys_dex sanity check
-		if(chunkrunner.keys_dex > 512) {
-			printf("\n\n\n>>>> ERROR: keys_dex > 512 (keys_dex = %i). Offset problem???\n",chunkrunner.keys_dex);
-			return 250;
-		}
-
-		// read in key values from file
-		fgetpos(fplfile, &fploffset);
-
-		// since we've already read 3 of the "keys" (key_primary,key_second, and key_sec_offset), we subtract 3
-		real_keys = chunkrunner.keys_dex - 3;
+	long recofz = ftell(fplfile);	// start of the current track record
+	unsigned int first = 0;			// range of playlist entries to process
+	unsigned int end = plsize;
 
-		if(verbose) printf("\tkeyrunner: reading %i (adjusted) values, starting offset = 0x%08X\n",real_keys,fploffset);
-		fread((void*)&keyrunner,sizeof(unsigned int),real_keys,fplfile);
-		fgetpos(fplfile, &fploffset);
-		if(verbose) printf("\tkeyrunner: ending offset = 0x%08X\n",fploffset);
-
-		// list key values
+	if(opt_mkindex) {
+		if(index_build(fplfile,filename,plsize,recofz)) return 251;
+		fseek(fplfile,recofz,SEEK_SET);
+	}
 
-		/*
-		if(verbose) {
-			printf("\tkeyrunner:\n");
-			for(int ii = 0; ii < real_keys; ii++) {
-				printf("\t  key(%i) = %i\n",ii,keyrunner[ii]);
+	// -offset / -limit: seek straight to the first entry with the index, or skip
+	// over the records before it without decoding them
+	if(opt_offset || opt_limit >= 0) {
+		first = (opt_offset < plsize) ? opt_offset : plsize;
+		if(opt_limit >= 0 && (unsigned int)opt_limit < plsize - first) end = first + opt_limit;
+
+		if(first > 0) {
+			long iofz = index_lookup(filename,plsize,first);
+			if(iofz >= 0) {
+				if(verbose) printf("fplidx: seeking to entry %u at offset 0x%08lX\n",first,iofz);
+				recofz = iofz;
+			} else if(skip_tracks(fplfile,0,first,&recofz)) {
+				return 250;
 			}
-			printf("\tkeyrunner done.\n");
+			fseek(fplfile,recofz,SEEK_SET);
 		}
-		*/
-
-		// enumerate track data from keyrunner
-		trx_dex = 0;  // reset trackrunner indexer
+	}
 
-		// Enumerate primary keys, which contain a key_value->field_name pair (hence, the x2 multiplier).
-		// After all the key_value->field_name pairs is a list of values which is preceeded by the
-		// key_value which is equal to key_primary's value
-		for(int ii = 0; ii < (chunkrunner.key_primary * 2); ii += 2) {			
-			// key value
-			trackrunner[trx_dex].key = keyrunner[ii];
-			// field name
-			strcpy(trackrunner[trx_dex].field_name,(char*)(dataprime + keyrunner[1+ii]));			
-			// value
-			//strcpy(trackrunner[trx_dex].value,(char*)(dataprime + keyrunner[1+trx_dex+(chunkrunner.key_primary * 2)]));
-			strcpy(trackrunner[trx_dex].value,(char*)(dataprime + keyrunner[1+trackrunner[trx_dex].key+(chunkrunner.key_primary * 2)]));
-			trx_dex++;
+	if(opt_pipeline) {
+		int pstatus = pipeline_run(fplfile,outtie,first,end,recofz);
+		if(pstatus) {
+			pipe_writer_finish();
+			return pstatus;
 		}
-
-		// enumerate secondary keys, which are field_name->value pairs, with NO key_value, as they are usually
-		// additional data that is not used as often
-		for(int ii = 0; ii < (chunkrunner.key_second * 2); ii += 2) {
-			// set the key value as -1 to represent UNDEFINED
-			trackrunner[trx_dex].key = -1; 
-			// field name
-			strcpy(trackrunner[trx_dex].field_name,(char*)(dataprime + keyrunner[ii+chunkrunner.key_sec_offset]));
-			// value
-			strcpy(trackrunner[trx_dex].value,(char*)(dataprime + keyrunner[1+ii+chunkrunner.key_sec_offset]));
-			trx_dex++;
+	} else {
+		for(unsigned int i = first; i < end && !feof(fplfile); i++) {
+			if(read_track(fplfile,i)) return 250;
+			if(process_track(outtie,recofz,i)) return 253;
+			recofz += sizeof(FPL_TRACK_CHUNK) + sizeof(unsigned int) * real_keys;
 		}
+	}
 
-		if(verbose) printf("\ttrackrunner enumerated %i attributes (expected %i)\n",trx_dex,attrib_count);
-
+	// re-read and output tracks in sorted order
+	if(sort_count) {
+		if(verbose) printf("sort: ordering tracks by %i keys...\n",sort_count);
+		if(sort_output(fplfile,outtie)) return 253;
+	}
 
-		// display data
+	// perform footer writing, if needed
+	out_lut[outmode].outfunc(outtie,(char*)NULL,-1);
+	ob_flush();
 
-		strcpy(tdata_fname,(char*)(dataprime + chunkrunner.file_ofz)); // get filename string
+	if(opt_compress && zpool_finish()) {
+		printf("error compressing output!\n");
+		return 252;
+	}
 
+	pipe_writer_finish();
 
-		if(verbose) {
-			printf("\ttrackrunner discovered track data!\n");
-			printf("\t  Track filename = \"%s\"\n",tdata_fname);		
-			
-			for(int ii = 0; ii < trx_dex; ii++) {
-				printf("\t  \"%s\" (key = %i) = \"%s\"\n",trackrunner[ii].field_name,trackrunner[ii].key,trackrunner[ii].value);
-			}
+	if(db_backend) {
+		db_backend->close();
+		if(db_failed) {
+			printf("error writing to %s database!\n",db_backend->name);
+			return 249;
 		}
+		if(verbose) printf("%s: %u rows written to \"%s\"\n",db_backend->name,db_rows,dbfile);
+	}
+
+	if(outmode == OUTMODE_EAV && eav_close()) {
+		printf("error writing EAV dictionaries!\n");
+		return 248;
+	}
 
+	if(outmode == OUTMODE_SHM && shm_failed) return 247;
 
-		if(verbose) printf("\ttrackrunner: calling %s output function...\n",out_lut[outmode].desc);
-		out_lut[outmode].outfunc(outtie,tdata_fname,trx_dex);
-		if(verbose) printf("\t <<< Finished for this track!\n\n\n");
+	if(outmode == OUTMODE_FPL && fplw_failed) {
+		printf("error building FPL output, playlist not written!\n");
+		return 246;
 	}
 
-	// perform footer writing, if needed
-	out_lut[outmode].outfunc(outtie,(char*)NULL,-1);
-
 	fclose(fplfile);
 	if(outtie) fclose(outtie);
 
+	ob_free();
+	esc_cache_free();
+	typed_cache_free();
+	free(dataprime);
+	free(remap_rules);
+	free(where_prog);
+	spec_free();
+
 	printf("Complete!\n\n\n");
 
 	return 0;
@@ -601,6 +1560,16 @@ char* get_attrib(char *astring, int listlen) {
 	return nullstring;
 }
 
+// same as get_attrib, but returns the value's string table offset (FPL_NO_OFZ if not found)
+unsigned int get_attrib_ofz(char *astring, int listlen) {
+	for(int i = 0; i < listlen; i++) {
+		if(!fpl_strcmpi(astring,trackrunner[i].field_name)) {
+			return trackrunner[i].value_ofz;
+		}
+	}
+	return FPL_NO_OFZ;
+}
+
 void escape_str(char *instr, char *outstr, int outbufsz) {
 
 	if(instr == NULL) return;
@@ -694,325 +1663,3931 @@ void xml_escape_str(char *instr, char *outstr, int outbufsz) {
 
 
 
-int null_output(FILE *outfile, char *trackfile, int listlen) {
+// JSON escape table: 0 = copy as-is, 'u' = \u00XX, anything else = backslash + that char
+static const char json_esc_lut[256] = {
+	'u','u','u','u','u','u','u','u','b','t','n','u','f','r','u','u',
+	'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u',
+	 0 , 0 ,'"', 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 ,
+	 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 ,
+	 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 ,
+	 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 , 0 ,'\\', 0 , 0 , 0
+	// 0x60 - 0xFF: copied as-is (UTF-8 passes through untouched)
+};
+
+static const char hexdigits[] = "0123456789abcdef";
+
+// escape one character of a JSON string into out; returns bytes written
+static inline int json_escape_char(unsigned char cc, char *out) {
+
+	char ee = json_esc_lut[cc];
+
+	if(ee == 0) {
+		out[0] = cc;
+		return 1;
+	} else if(cc == '\\' && opt_fslash) {
+		out[0] = '/';
+		return 1;
+	} else if(ee == 'u') {
+		out[0] = '\\'; out[1] = 'u'; out[2] = '0'; out[3] = '0';
+		out[4] = hexdigits[cc >> 4];
+		out[5] = hexdigits[cc & 15];
+		return 6;
+	}
+
+	out[0] = '\\';
+	out[1] = ee;
+	return 2;
+}
+
+void json_escape_str(char *instr, char *outstr, int outbufsz) {
+
+	if(instr == NULL) return;
+
+	int curzz = 0;
+
+	for(unsigned char *ip = (unsigned char*)instr; *ip && curzz < outbufsz - 6; ip++) {
+		curzz += json_escape_char(*ip,outstr + curzz);
+	}
+
+	outstr[curzz] = NULL;
+
+	return;
+}
+
+
+/*
+
+Output buffer
+
+All output is collected in one large buffer and written with a single fwrite
+whenever it fills up, instead of one stdio call per field.
+
+*/
+
+// set up the output buffer for outfile (which may be NULL); returns non-zero on error
+int ob_init(FILE *outfile) {
+
+	outbuf.outfile = outfile;
+	outbuf.len = 0;
+	outbuf.cap = OUTBUF_SZ;
+
+	if((outbuf.buf = (char*)malloc(outbuf.cap)) == NULL) return 1;
 
 	return 0;
 }
 
-int csv_output(FILE *outfile, char *trackfile, int listlen) {
+static void zpool_submit();
+static void pipe_submit(bool last);
 
-	static bool headerwrite = false;
+void ob_flush() {
+	if(opt_compress) {
+		if(outbuf.len) zpool_submit();
+		return;
+	}
+	if(pipe_cur) {
+		if(outbuf.len) pipe_submit(false);
+		return;
+	}
+	if(outbuf.len && outbuf.outfile) fwrite(outbuf.buf,outbuf.len,1,outbuf.outfile);
+	outbuf.len = 0;
+}
 
-	double durationdub;
-	unsigned int i_bitrate;
-
-	char t_trackfile[1024];
-	char t_title[512];
-	char t_artist[512];
-	char t_album_artist[512];
-	char t_album[512];
-	char t_tracknumber[64];
-	char t_genre[512];
-	char t_date[64];
-	char t_codec[64];
-	char t_codec_profile[64];
-	char option1[256];
-
-	int t_tracknum_int = -1;
+void ob_free() {
+	free(outbuf.buf);
+	outbuf.buf = NULL;
+	outbuf.len = outbuf.cap = 0;
+}
 
-	// write header
-	if(!headerwrite) {
-		fprintf(outfile,"filename, title, artist, album_artist, album, tracknum, genre, year, duration, bitrate, codec, codec_profile, filesize, option1\n");
-		headerwrite = true;
+// make room for at least len more bytes (flushing if needed); false if len can't fit at all
+static inline bool ob_reserve(size_t len) {
+	if(outbuf.len + len > outbuf.cap) ob_flush();
+	return (len <= outbuf.cap);
+}
+
+void ob_write(const char *data, size_t len) {
+
+	if(len == 0) return;
+
+	if(!ob_reserve(len)) {
+		// larger than the whole buffer: pass it through in buffer-sized pieces, so
+		// it still goes through compression (-z) and the writer thread (-pipeline)
+		while(len > outbuf.cap - outbuf.len) {
+			size_t nn = outbuf.cap - outbuf.len;
+			memcpy(outbuf.buf + outbuf.len,data,nn);
+			outbuf.len += nn;
+			data += nn;
+			len -= nn;
+			ob_flush();
+		}
 	}
 
-	// write footer (if needed)
-	if(listlen == -1) {
-		return 150;
+	memcpy(outbuf.buf + outbuf.len,data,len);
+	outbuf.len += len;
+}
+
+void ob_puts(const char *str) {
+	ob_write(str,strlen(str));
+}
+
+// printf into the output buffer
+void ob_printf(const char *fmt, ...) {
+
+	va_list ap;
+	int     nn;
+
+	if(outbuf.cap - outbuf.len < 4096) ob_flush();
+
+	va_start(ap,fmt);
+	nn = vsnprintf(outbuf.buf + outbuf.len,outbuf.cap - outbuf.len,fmt,ap);
+	va_end(ap);
+
+	if(nn < 0) return;
+	if((size_t)nn < outbuf.cap - outbuf.len) {
+		outbuf.len += nn;
+		return;
 	}
 
-	escape_str(trackfile,t_trackfile,1024);
-	escape_str(get_attrib("title",listlen),t_title,512);
-	escape_str(get_attrib("artist",listlen),t_artist,512);
-	escape_str(get_attrib("album artist",listlen),t_album_artist,512);
-	escape_str(get_attrib("album",listlen),t_album,512);
-	if(strlen(t_album_artist) < 3) {
-		strcpy(t_album_artist,t_artist);
+	// didn't fit: flush and format again
+	ob_flush();
+
+	char *dest = outbuf.buf;
+	char *tmp = NULL;
+	if((size_t)nn >= outbuf.cap) {
+		if((tmp = (char*)malloc(nn + 1)) == NULL) return;
+		dest = tmp;
 	}
 
-	if(opt_alb_only) {
-		if(!strcmp(last_aa,t_album_artist) && !strcmp(last_alb,t_album)) return 200;	// output rows with unique album/artist only
+	va_start(ap,fmt);
+	vsnprintf(dest,nn + 1,fmt,ap);
+	va_end(ap);
+
+	if(tmp) {
+		ob_write(tmp,nn);
+		free(tmp);
+	} else {
+		outbuf.len = nn;
 	}
-	strcpy(last_aa,t_album_artist);
-	strcpy(last_alb,t_album);
+}
 
+void ob_put_uint(unsigned long long val) {
 
-	/*
-	if(!sscanf(get_attrib("tracknumber",listlen),"%*2i.%i",&t_tracknum_int)) {
-		if(!sscanf(get_attrib("tracknumber",listlen),"%*1i%2i",&t_tracknum_int)){
-			if(!sscanf(get_attrib("tracknumber",listlen),"%*2i/%2i",&t_tracknum_int)) {
-				sscanf(get_attrib("tracknumber",listlen),"%2i",&t_tracknum_int);
-			}
+	char  dbuf[24];
+	char *dp = dbuf + sizeof(dbuf);
+
+	do {
+		*--dp = '0' + (char)(val % 10);
+		val /= 10;
+	} while(val);
+
+	ob_write(dp,dbuf + sizeof(dbuf) - dp);
+}
+
+// fixed-point decimal (decimals <= 9), same text as printf's %.*f (nan, inf, ...)
+void ob_put_fixed(double val, int decimals) {
+
+	static const unsigned long long pow10[] = { 1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL,
+	                                            1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL };
+
+	if(val != val || val > 1e300 || val < -1e300) {
+		ob_printf("%.*f",decimals,val);
+		return;
+	}
+
+	if(val < 0) {
+		ob_write("-",1);
+		val = -val;
+	}
+
+	// beyond exact integer range: let printf deal with it
+	double scaledf = val * pow10[decimals];
+	if(scaledf >= 1e15) {
+		char nbuf[64];
+		ob_write(nbuf,snprintf(nbuf,sizeof(nbuf),"%.*f",decimals,val));
+		return;
+	}
+
+	// round like printf: the product may have rounded onto the halfway point,
+	// so decide on its exact residual, and round true ties to even
+	unsigned long long scaled = (unsigned long long)scaledf;
+	double rem = scaledf - (double)scaled;
+	if(rem > 0.5) {
+		scaled++;
+	} else if(rem == 0.5) {
+		double err = fma(val,(double)pow10[decimals],-scaledf);
+		if(err > 0 || (err == 0 && (scaled & 1))) scaled++;
+	}
+	ob_put_uint(scaled / pow10[decimals]);
+
+	if(decimals > 0) {
+		char  fbuf[16];
+		unsigned long long frac = scaled % pow10[decimals];
+		fbuf[0] = '.';
+		for(int i = decimals; i > 0; i--) {
+			fbuf[i] = '0' + (char)(frac % 10);
+			frac /= 10;
 		}
+		ob_write(fbuf,decimals + 1);
 	}
-	*/
+}
 
-	if(t_tracknum_int != -1) {
-		sprintf(t_tracknumber,"%i",t_tracknum_int);
-	} else {
-		strcpy(t_tracknumber,get_attrib("tracknumber",listlen));
+// write str as a quoted JSON string, escaping straight into the output buffer
+void ob_put_json_str(const char *str) {
+
+	size_t sl = strlen(str);
+
+	if(!ob_reserve(sl * 6 + 2)) {
+		// huge value: go through in pieces
+		ob_write("\"",1);
+		for(const unsigned char *sp = (const unsigned char*)str; *sp; sp++) {
+			char eb[8];
+			ob_write(eb,json_escape_char(*sp,eb));
+		}
+		ob_write("\"",1);
+		return;
 	}
 
-	// if option_windrive is enabled, put the drive letter into option1
-	if(option_windrive) {
-		option1[0] = toupper(t_trackfile[7]);
-		option1[1] = NULL;
-	} else {
-		option1[0] = NULL;
+	char *op = outbuf.buf + outbuf.len;
+	*op++ = '"';
+	for(const unsigned char *sp = (const unsigned char*)str; *sp; sp++) {
+		op += json_escape_char(*sp,op);
 	}
+	*op++ = '"';
 
-	escape_str(get_attrib("genre",listlen),t_genre,512);
-	escape_str(get_attrib("date",listlen),t_date,64);
-	escape_str(get_attrib("codec",listlen),t_codec,64);
-	escape_str(get_attrib("codec_profile",listlen),t_codec_profile,64);
+	outbuf.len = op - outbuf.buf;
+}
 
-	// get duration
-	memcpy((void*)&durationdub,chunkrunner.duration_dbl,8);
 
-	// filename, title, artist, album_artist, album, tracknum, genre, year, duration, bitrate, codec, codec_profile, filesize, option1
+/*
+
+Compressed output (-z)
+
+When compression is enabled, ob_flush hands the full output buffer to a pool of
+worker threads as one block and carries on with a fresh buffer. Every block is
+compressed independently into a complete gzip member or zstd frame, so blocks
+can be written back to back and still form one valid stream. The main thread
+writes finished blocks in submission order; at most two blocks per worker are
+kept in flight before it waits.
+
+*/
+
+static void zpool_compress(FPL_ZBLOCK *zb) {
+
+	int level = opt_zlevel;
+
+#ifdef FPL_USE_ZLIB
+	if(opt_compress == COMPRESS_GZIP) {
+		z_stream zs;
+		memset(&zs,0,sizeof(zs));
+
+		// windowBits 15 + 16 = gzip wrapper
+		if(deflateInit2(&zs,(level < 0) ? Z_DEFAULT_COMPRESSION : level,Z_DEFLATED,15 + 16,8,Z_DEFAULT_STRATEGY) != Z_OK) {
+			zb->failed = true;
+			return;
+		}
+
+		size_t zcap = deflateBound(&zs,(uLong)zb->inlen) + 64;
+		if((zb->zbuf = (char*)malloc(zcap)) == NULL) {
+			deflateEnd(&zs);
+			zb->failed = true;
+			return;
+		}
+
+		zs.next_in   = (Bytef*)zb->inbuf;
+		zs.avail_in  = (uInt)zb->inlen;
+		zs.next_out  = (Bytef*)zb->zbuf;
+		zs.avail_out = (uInt)zcap;
+
+		if(deflate(&zs,Z_FINISH) != Z_STREAM_END) zb->failed = true;
+		zb->zlen = zs.total_out;
+		deflateEnd(&zs);
+		return;
+	}
+#endif
+
+#ifdef FPL_USE_ZSTD
+	if(opt_compress == COMPRESS_ZSTD) {
+		size_t zcap = ZSTD_compressBound(zb->inlen);
+		if((zb->zbuf = (char*)malloc(zcap)) == NULL) {
+			zb->failed = true;
+			return;
+		}
+
+		zb->zlen = ZSTD_compress(zb->zbuf,zcap,zb->inbuf,zb->inlen,(level < 0) ? ZSTD_CLEVEL_DEFAULT : level);
+		if(ZSTD_isError(zb->zlen)) zb->failed = true;
+		return;
+	}
+#endif
+
+	(void)level;
+	zb->failed = true;
+}
+
+static void zpool_worker() {
+
+	for(;;) {
+		FPL_ZBLOCK *zb;
+		{
+			std::unique_lock<std::mutex> lk(zp_lock);
+			zp_cv_work.wait(lk,[]{ return zp_shutdown || !zp_queue.empty(); });
+			if(zp_queue.empty()) return;
+			zb = zp_queue.front();
+			zp_queue.pop_front();
+		}
+
+		zpool_compress(zb);
+
+		{
+			std::lock_guard<std::mutex> lk(zp_lock);
+			zb->done = true;
+		}
+		zp_cv_done.notify_all();
+	}
+}
+
+int zpool_start() {
 
-	i_bitrate = atoi(get_attrib("bitrate",listlen));
+	int nthreads = (int)std::thread::hardware_concurrency();
+	if(nthreads < 1) nthreads = 1;
 
-	fprintf(outfile,"\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",%0.02f,%i,\"%s\",\"%s\",%i,\"%s\"\n" ,
-						t_trackfile,								// filex
-						t_title,									// titlex
-						t_artist,									// artist
-						t_album_artist,								// album_artist
-						t_album,									// album
-						t_tracknumber,								// tracknum
-						t_genre,									// genre
-						t_date,										// year
-						durationdub,								// duration (in seconds)
-						i_bitrate,									// bitrate
-						t_codec,									// codec
-						t_codec_profile,							// codec_profile
-						chunkrunner.fsize,							// filesize
-						option1										// optional parameter
-						
-			);
+	zp_shutdown = false;
 
+	try {
+		for(int t = 0; t < nthreads; t++) zp_workers.push_back(std::thread(zpool_worker));
+	} catch(...) {
+		return 1;
+	}
+
+	if(verbose) printf("zpool: %i compression threads started\n",nthreads);
 
 	return 0;
 }
 
+// write out finished blocks from the head of the in-flight list. with wait_all,
+// waits for everything; otherwise only waits while too many blocks are pending
+static void zpool_drain(bool wait_all) {
+
+	size_t max_inflight = wait_all ? 0 : zp_workers.size() * 2;
+
+	for(;;) {
+		FPL_ZBLOCK *zb;
+		{
+			std::unique_lock<std::mutex> lk(zp_lock);
+			if(zp_inflight.empty()) return;
+			zb = zp_inflight.front();
+			if(!zb->done) {
+				if(zp_inflight.size() <= max_inflight) return;
+				zp_cv_done.wait(lk,[zb]{ return zb->done; });
+			}
+			zp_inflight.pop_front();
+		}
+
+		if(zb->failed) zp_failed = true;
+		else if(outbuf.outfile) fwrite(zb->zbuf,zb->zlen,1,outbuf.outfile);
+
+		free(zb->zbuf);
+		zp_freebufs.push_back(zb->inbuf);
+		delete zb;
+	}
+}
+
+// queue the current output buffer for compression and switch to a fresh one
+static void zpool_submit() {
+
+	char *nbuf;
+
+	if(!zp_freebufs.empty()) {
+		nbuf = zp_freebufs.back();
+		zp_freebufs.pop_back();
+	} else if((nbuf = (char*)malloc(outbuf.cap)) == NULL) {
+		// no memory for another buffer: wait for a block to finish and reuse its buffer
+		zpool_drain(true);
+		if(zp_freebufs.empty()) {
+			printf("error allocating memory for compression buffer!\n");
+			zp_failed = true;
+			outbuf.len = 0;
+			return;
+		}
+		nbuf = zp_freebufs.back();
+		zp_freebufs.pop_back();
+	}
+
+	FPL_ZBLOCK *zb = new FPL_ZBLOCK();
+	zb->inbuf = outbuf.buf;
+	zb->inlen = outbuf.len;
+
+	outbuf.buf = nbuf;
+	outbuf.len = 0;
+
+	{
+		std::lock_guard<std::mutex> lk(zp_lock);
+		zp_queue.push_back(zb);
+		zp_inflight.push_back(zb);
+	}
+	zp_cv_work.notify_one();
+
+	zpool_drain(false);
+}
+
+// write all remaining blocks and stop the workers; returns non-zero on error
+int zpool_finish() {
+
+	zpool_drain(true);
+
+	{
+		std::lock_guard<std::mutex> lk(zp_lock);
+		zp_shutdown = true;
+	}
+	zp_cv_work.notify_all();
+
+	for(size_t t = 0; t < zp_workers.size(); t++) zp_workers[t].join();
+	zp_workers.clear();
+
+	for(size_t i = 0; i < zp_freebufs.size(); i++) free(zp_freebufs[i]);
+	zp_freebufs.clear();
+
+	return zp_failed ? 1 : 0;
+}
+
+
 /*
 
-XML, Rhythmbox-compatible schema
+Sidecar index (.fplidx)
 
-added 12.08.2010 - jacob
+Track records are variable-length, so reaching entry N normally means walking
+every record before it. The index stores the file offset of each record, stamped
+with the FPL file's size and modification time; a stale index is ignored.
 
 */
 
-int xml_output(FILE *outfile, char *trackfile, int listlen) {
+// playlist.fpl -> playlist.fplidx (anything else gets .fplidx appended)
+static void index_filename(char *idxname, int idxsz, const char *fplname) {
 
-	static bool headerwrite = false;
+	const char *ext = strrchr(fplname,'.');
 
-        double durationdub;
-        unsigned int i_bitrate;
-
-        char t_trackfile[1024];
-        char t_title[512];
-        char t_artist[512];
-        char t_album_artist[512];
-        char t_album[512];
-        char t_tracknumber[64];
-        char t_genre[512];
-        char t_date[64];
-        char t_codec[64];
-        char t_codec_profile[64];
-        //char option1[256];
-
-        int t_tracknum_int = -1;
-	int i_unixdate     = 0;
-
-        // write header
-        if(!headerwrite) {
-		fprintf(outfile,"<?xml version=\"1.0\" standalone=\"yes\"?>\n");
-		fprintf(outfile,"<rhythmdb version=\"1.7\">\n");
-                headerwrite = true;
-        }
+	if(ext && !fpl_strcmpi(ext,".fpl")) snprintf(idxname,idxsz,"%sidx",fplname);
+	else                                snprintf(idxname,idxsz,"%s.fplidx",fplname);
+}
 
-	// write footer
-	if(listlen == -1) {
-		fprintf(outfile,"</rhythmdb>\n");
-		return 150;
+// skip count track records, starting at playlist entry tdex, without decoding them;
+// recofz is advanced past them
+int skip_tracks(FILE *fplfile, unsigned int tdex, unsigned int count, long *recofz) {
+
+	FPL_TRACK_CHUNK chunk;
+
+	for(unsigned int i = 0; i < count; i++) {
+		if(fread(&chunk,sizeof(FPL_TRACK_CHUNK),1,fplfile) != 1) {
+			printf("error: playlist ended before entry %u!\n",tdex + i);
+			return 1;
+		}
+		if(chunk.keys_dex > 512 || chunk.keys_dex < 3) {
+			printf("\n\n\n>>>> ERROR: keys_dex > 512 (keys_dex = %i) at entry %u. Offset problem???\n",chunk.keys_dex,tdex + i);
+			return 1;
+		}
+		fseek(fplfile,sizeof(unsigned int) * (chunk.keys_dex - 3),SEEK_CUR);
+		*recofz += sizeof(FPL_TRACK_CHUNK) + sizeof(unsigned int) * (chunk.keys_dex - 3);
 	}
 
-        xml_escape_str(trackfile,t_trackfile,1024);
-        strcpy(t_title,		get_attrib("title",listlen));
-        strcpy(t_artist,	get_attrib("artist",listlen));
-        strcpy(t_album_artist,	get_attrib("album artist",listlen));
-        strcpy(t_album,		get_attrib("album",listlen));
-	strcpy(t_genre,		get_attrib("genre",listlen));
-	strcpy(t_date,		get_attrib("date",listlen));
-	strcpy(t_codec,		get_attrib("codec",listlen));
-	strcpy(t_codec_profile,	get_attrib("codec_profile",listlen));        
+	return 0;
+}
 
-	if(strlen(t_album_artist) < 3) {
-                strcpy(t_album_artist,t_artist);
-        }
+// walk all track records from recofz and write the sidecar index; returns non-zero on error
+int index_build(FILE *fplfile, char *fplname, unsigned int plsize, long recofz) {
 
-        // get duration
-        memcpy((void*)&durationdub,chunkrunner.duration_dbl,8);
+	char            idxname[1100];
+	struct stat     st;
+	FPL_IDX_HEADER  hdr;
+	FILE           *idxfile;
+	unsigned int   *offsets;
 
-	// format tracknumber
-        if(t_tracknum_int != -1) {
-                sprintf(t_tracknumber,"%i",t_tracknum_int);
-        } else {
-                strcpy(t_tracknumber,get_attrib("tracknumber",listlen));
-        }
+	if(stat(fplname,&st)) {
+		printf("error: unable to stat \"%s\"!\n",fplname);
+		return 1;
+	}
 
-	// year to unix timestamp conversion (needs work -- TODO)
-	int tsy = atoi(t_date);
-	if(tsy > 1900 && tsy < 2100) {
-		i_unixdate = ((tsy - 1970) * 31556926) + 1;
-	} else {
-		i_unixdate = 0;
-	}
-
-        // filename, title, artist, album_artist, album, tracknum, genre, year, duration, bitrate, codec, codec_profile, filesize, option1
-
-        i_bitrate = atoi(get_attrib("bitrate",listlen));
-
-	// rhythmbox does not completely support album_artist tags
-	// but has something similar called artist-sort
-	// so for compatibility both tags will be written
-	fprintf(outfile,"  <entry type=\"song\">\n");
-	fprintf(outfile,"    <title>%s</title>\n",t_title);
-	fprintf(outfile,"    <genre>%s</genre>\n",t_genre);
-	//fprintf(outfile,"    <album-artist>%s</album-artist>\n",t_album_artist);
-	//fprintf(outfile,"    <artist-sort>%s</artist-sort>\n",t_album_artist);
-	fprintf(outfile,"    <artist>%s</artist>\n",t_artist);
-	fprintf(outfile,"    <album>%s</album>\n",t_album);
-	fprintf(outfile,"    <track-number>%s</track-number>\n",t_tracknumber);
-	fprintf(outfile,"    <duration>%.0f</duration>\n",durationdub);
-	fprintf(outfile,"    <file-size>%i</file-size>\n",chunkrunner.fsize);
-	fprintf(outfile,"    <location>%s</location>\n",t_trackfile);
-	fprintf(outfile,"    <mountpoint>file://%c%c</mountpoint>\n",t_trackfile[7],t_trackfile[8]);
-	fprintf(outfile,"    <mtime>1269409449</mtime>\n");
-	fprintf(outfile,"    <last-seen>1291856711</last-seen>\n");
-	fprintf(outfile,"    <bitrate>%i</bitrate>\n",i_bitrate);
-	//fprintf(outfile,"    <date>%i</date>\n",i_unixdate);
-	fprintf(outfile,"    <date>0</date>\n");
-	fprintf(outfile,"    <mimetype>application/x-id3</mimetype>\n");
-	// additional fields (might not be used by rhythmbox)
-	//fprintf(outfile,"\t\t<codec>%s</codec>\n",t_codec);
-	//fprintf(outfile,"\t\t<codec-profile>%s</codec-profile>\n",t_codec_profile);
-	fprintf(outfile,"  </entry>\n");
+	if((offsets = (unsigned int*)malloc(sizeof(unsigned int) * (plsize ? plsize : 1))) == NULL) {
+		printf("error allocating memory for index!\n");
+		return 1;
+	}
 
-	return 0;
+	for(unsigned int i = 0; i < plsize; i++) {
+		offsets[i] = (unsigned int)recofz;
+		if(skip_tracks(fplfile,i,1,&recofz)) {
+			free(offsets);
+			return 1;
+		}
+	}
+
+	memset(&hdr,0,sizeof(hdr));
+	memcpy(hdr.magic,FPLIDX_MAGIC,8);
+	hdr.version = FPLIDX_VERSION;
+	hdr.track_count = plsize;
+	hdr.fpl_size = (unsigned long long)st.st_size;
+	hdr.fpl_mtime = (long long)st.st_mtime;
+
+	index_filename(idxname,sizeof(idxname),fplname);
+
+	if((idxfile = fopen(idxname,"wb")) == NULL) {
+		printf("error: unable to open index file \"%s\" for writing!\n",idxname);
+		free(offsets);
+		return 1;
+	}
+
+	fwrite(&hdr,sizeof(hdr),1,idxfile);
+	fwrite(offsets,sizeof(unsigned int),plsize,idxfile);
+
+	int status = ferror(idxfile) ? 1 : 0;
+	fclose(idxfile);
+	free(offsets);
+
+	if(status) printf("error writing index file \"%s\"!\n",idxname);
+	else       printf("Wrote index \"%s\" (%u tracks)\n",idxname,plsize);
+
+	return status;
 }
 
+// record offset of entry tdex from a current sidecar index, or -1 if there is none
+long index_lookup(char *fplname, unsigned int plsize, unsigned int tdex) {
 
-int sqlfile_output(FILE *outfile, char *trackfile, int listlen) {
+	char            idxname[1100];
+	struct stat     st;
+	FPL_IDX_HEADER  hdr;
+	FILE           *idxfile;
+	unsigned int    ofz;
 
-	double durationdub;
-	unsigned int i_bitrate;
-
-	char t_trackfile[1024];
-	char t_title[512];
-	char t_artist[512];
-	char t_album_artist[512];
-	char t_album[512];
-	char t_tracknumber[64];
-	char t_genre[512];
-	char t_date[64];
-	char t_codec[64];
-	char t_codec_profile[64];
-	int t_tracknum_int = -1;
+	index_filename(idxname,sizeof(idxname),fplname);
 
-	// footer callback... we dont need this for SQL file output.. ignore it
-	if(listlen == -1) return 150;
+	if(stat(fplname,&st) || (idxfile = fopen(idxname,"rb")) == NULL) return -1;
 
-	escape_str(trackfile,t_trackfile,1024);
-	escape_str(get_attrib("title",listlen),t_title,512);
-	escape_str(get_attrib("artist",listlen),t_artist,512);
-	escape_str(get_attrib("album artist",listlen),t_album_artist,512);
-	escape_str(get_attrib("album",listlen),t_album,512);
-	if(strlen(t_album_artist) < 3) {
-		strcpy(t_album_artist,t_artist);
+	bool valid = (fread(&hdr,sizeof(hdr),1,idxfile) == 1 &&
+	              !memcmp(hdr.magic,FPLIDX_MAGIC,8) &&
+	              hdr.version == FPLIDX_VERSION &&
+	              hdr.track_count == plsize && tdex < plsize &&
+	              hdr.fpl_size == (unsigned long long)st.st_size &&
+	              hdr.fpl_mtime == (long long)st.st_mtime);
+
+	if(valid) {
+		valid = (fseek(idxfile,(long)(sizeof(hdr) + sizeof(unsigned int) * tdex),SEEK_SET) == 0 &&
+		         fread(&ofz,sizeof(ofz),1,idxfile) == 1);
+	} else if(verbose) {
+		printf("fplidx: \"%s\" is out of date, ignoring it\n",idxname);
 	}
 
-	/*
-	if(!sscanf(get_attrib("tracknumber",listlen),"%*2i.%i",&t_tracknum_int)) {
-		if(!sscanf(get_attrib("tracknumber",listlen),"%*1i%2i",&t_tracknum_int)){
-			if(!sscanf(get_attrib("tracknumber",listlen),"%*2i/%2i",&t_tracknum_int)) {
-				sscanf(get_attrib("tracknumber",listlen),"%2i",&t_tracknum_int);
-			}
+	fclose(idxfile);
+
+	return valid ? (long)ofz : -1;
+}
+
+
+/*
+
+Pipelined execution (-pipeline)
+
+Three threads connected by bounded SPSC rings:
+
+  reader   reads track records (chunk + key array) into pipe_recs
+  decoder  the main thread: decodes attributes, filters and formats rows
+           (process_track) into output buffers that live in pipe_out
+  writer   fwrite()s each full output buffer, then hands the slot back
+
+A full ring makes the producing side wait, so neither the reader nor the decoder
+can run more than a fixed number of records/buffers ahead of the next stage.
+
+*/
+
+static int spsc_init(FPL_SPSC_RING *ring, size_t elemsz, size_t cap) {
+	ring->elemsz = elemsz;
+	ring->cap = cap;
+	ring->head.store(0);
+	ring->tail.store(0);
+	ring->sleepers.store(0);
+	ring->data = (char*)calloc(cap,elemsz);
+	return (ring->data == NULL) ? 1 : 0;
+}
+
+static void spsc_free(FPL_SPSC_RING *ring) {
+	free(ring->data);
+	ring->data = NULL;
+}
+
+// wait until ready() holds: yield for up to SPSC_SPINS rounds, then sleep on cv.
+// sleepers and the head/tail stores are seq_cst, so either the waker sees the
+// sleeper or the sleeper's final check sees the new index
+template<typename F> static void spsc_wait(FPL_SPSC_RING *ring, F ready) {
+	for(int spins = 0; !ready(); spins++) {
+		if(spins < SPSC_SPINS) {
+			std::this_thread::yield();
+			continue;
 		}
+		std::unique_lock<std::mutex> lk(ring->lock);
+		ring->sleepers.fetch_add(1);
+		ring->cv.wait(lk,ready);
+		ring->sleepers.fetch_sub(1);
+		return;
 	}
-	*/
+}
 
-	if(t_tracknum_int != -1) {
-		sprintf(t_tracknumber,"%i",t_tracknum_int);
-	} else {
-		strcpy(t_tracknumber,get_attrib("tracknumber",listlen));
+// wake the other side if it's sleeping in spsc_wait
+static inline void spsc_wake(FPL_SPSC_RING *ring) {
+	if(ring->sleepers.load() == 0) return;
+	std::lock_guard<std::mutex> lk(ring->lock);
+	ring->cv.notify_all();
+}
+
+// producer: wait for a free element and return it
+static void* spsc_claim(FPL_SPSC_RING *ring) {
+	size_t tail = ring->tail.load(std::memory_order_relaxed);
+	spsc_wait(ring,[ring,tail]{ return tail - ring->head.load() < ring->cap; });
+	return ring->data + (tail & (ring->cap - 1)) * ring->elemsz;
+}
+
+// producer: make the claimed element visible to the consumer
+static void spsc_publish(FPL_SPSC_RING *ring) {
+	ring->tail.store(ring->tail.load(std::memory_order_relaxed) + 1);
+	spsc_wake(ring);
+}
+
+// consumer: wait for the next element and return it
+static void* spsc_peek(FPL_SPSC_RING *ring) {
+	size_t head = ring->head.load(std::memory_order_relaxed);
+	spsc_wait(ring,[ring,head]{ return ring->tail.load() != head; });
+	return ring->data + (head & (ring->cap - 1)) * ring->elemsz;
+}
+
+// consumer: done with the element, give it back to the producer
+static void spsc_release(FPL_SPSC_RING *ring) {
+	ring->head.store(ring->head.load(std::memory_order_relaxed) + 1);
+	spsc_wake(ring);
+}
+
+// stage 1: read raw track records
+static void pipe_reader(FILE *fplfile, unsigned int first, unsigned int end, long recofz) {
+
+	for(unsigned int i = first; ; i++) {
+		FPL_PIPE_REC *rec = (FPL_PIPE_REC*)spsc_claim(&pipe_recs);
+
+		rec->status = PIPE_REC_END;
+
+		if(i < end && fread(&rec->chunk,sizeof(FPL_TRACK_CHUNK),1,fplfile) == 1) {
+			if(rec->chunk.keys_dex > 512 || rec->chunk.keys_dex < 3) {
+				rec->status = PIPE_REC_ERROR;
+			} else {
+				rec->status = PIPE_REC_TRACK;
+				rec->tdex = i;
+				rec->ofz = recofz;
+				rec->real_keys = rec->chunk.keys_dex - 3;
+				if(fread(rec->keys,sizeof(unsigned int),rec->real_keys,fplfile) != (size_t)rec->real_keys) {
+					rec->status = PIPE_REC_SHORT;
+				}
+				recofz += sizeof(FPL_TRACK_CHUNK) + sizeof(unsigned int) * rec->real_keys;
+			}
+		}
+
+		spsc_publish(&pipe_recs);
+		if(rec->status != PIPE_REC_TRACK) return;
 	}
+}
 
-	escape_str(get_attrib("genre",listlen),t_genre,512);
-	escape_str(get_attrib("date",listlen),t_date,64);
-	escape_str(get_attrib("codec",listlen),t_codec,64);
-	escape_str(get_attrib("codec_profile",listlen),t_codec_profile,64);
+// stage 3: write output buffers
+static void pipe_writer_main() {
 
-	// get duration
-	memcpy((void*)&durationdub,chunkrunner.duration_dbl,8);
+	for(;;) {
+		FPL_PIPE_BLOCK *blk = (FPL_PIPE_BLOCK*)spsc_peek(&pipe_out);
+		bool last = blk->last;
 
-	// key, filename, title, artist, album artist, tracknum, genre, year, duration, bitrate,
+		if(blk->len) fwrite(blk->buf,blk->len,1,outbuf.outfile);
+		blk->len = 0;
+
+		spsc_release(&pipe_out);
+		if(last) return;
+	}
+}
 
-	i_bitrate = atoi(get_attrib("bitrate",listlen));
+// hand the current output buffer to the writer and continue in the next slot
+static void pipe_submit(bool last) {
 
-	fprintf(outfile,"INSERT INTO %s VALUES(%i,\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",\"%s\",%0.02f,%i,\"%s\",\"%s\",%i);\n\r" ,
-						sql_table,									// mysql
-						0,											// key (auto-generated by mySQL)
-						t_trackfile,								// filex
-						t_title,									// titlex
-						t_artist,									// artist
-						t_album_artist,								// album_artist
-						t_album,									// album
-						t_tracknumber,								// tracknum
-						t_genre,									// genre
-						t_date,										// year
-						durationdub,								// duration (in seconds)
-						i_bitrate,									// bitrate
-						t_codec,									// codec
-						t_codec_profile,							// codec_profile
-						chunkrunner.fsize							// filesize
-						
-			);
+	pipe_cur->len = outbuf.len;
+	pipe_cur->last = last;
+	spsc_publish(&pipe_out);
 
+	if(last) {
+		pipe_cur = NULL;
+		return;
+	}
 
-	return 0;
+	pipe_cur = (FPL_PIPE_BLOCK*)spsc_claim(&pipe_out);
+	outbuf.buf = pipe_cur->buf;
+	outbuf.len = 0;
 }
 
+// start the writer stage; output buffers now come from pipe_out
+int pipe_writer_start() {
 
+	if(spsc_init(&pipe_out,sizeof(FPL_PIPE_BLOCK),PIPE_OUT_SLOTS)) return 1;
 
-int mysql_output(FILE *outfile, char *trackfile, int listlen) {
+	for(int i = 0; i < PIPE_OUT_SLOTS; i++) {
+		FPL_PIPE_BLOCK *blk = (FPL_PIPE_BLOCK*)(pipe_out.data + i * sizeof(FPL_PIPE_BLOCK));
+		if((blk->buf = (char*)malloc(outbuf.cap)) == NULL) return 1;
+	}
 
+	pipe_saved_buf = outbuf.buf;
+	pipe_cur = (FPL_PIPE_BLOCK*)spsc_claim(&pipe_out);
+	outbuf.buf = pipe_cur->buf;
+	outbuf.len = 0;
 
+	try {
+		pipe_writer = std::thread(pipe_writer_main);
+	} catch(...) {
+		return 1;
+	}
 
 	return 0;
 }
 
-int m3u_output(FILE *outfile, char *trackfile, int listlen) {
+// flush the last buffer and wait for the writer to finish
+void pipe_writer_finish() {
 
+	if(pipe_cur == NULL) return;
 
+	pipe_submit(true);
+	pipe_writer.join();
 
-	return 0;
+	for(int i = 0; i < PIPE_OUT_SLOTS; i++) {
+		free(((FPL_PIPE_BLOCK*)(pipe_out.data + i * sizeof(FPL_PIPE_BLOCK)))->buf);
+	}
+	spsc_free(&pipe_out);
+
+	outbuf.buf = pipe_saved_buf;
+	outbuf.len = 0;
 }
 
-int m3u_noext_output(FILE *outfile, char *trackfile, int listlen) {
+// run the reader stage on its own thread and decode on this one; returns non-zero on error
+int pipeline_run(FILE *fplfile, FILE *outtie, unsigned int first, unsigned int end, long recofz) {
 
+	int status = 0;
+
+	if(spsc_init(&pipe_recs,sizeof(FPL_PIPE_REC),PIPE_REC_SLOTS)) {
+		printf("error allocating memory for pipeline!\n");
+		return 254;
+	}
+
+	std::thread reader;
+	try {
+		reader = std::thread(pipe_reader,fplfile,first,end,recofz);
+	} catch(...) {
+		printf("error starting pipeline reader thread!\n");
+		spsc_free(&pipe_recs);
+		return 254;
+	}
+
+	for(;;) {
+		FPL_PIPE_REC *rec = (FPL_PIPE_REC*)spsc_peek(&pipe_recs);
+
+		if(rec->status == PIPE_REC_ERROR) {
+			printf("\n\n\n>>>> ERROR: keys_dex > 512 (keys_dex = %i). Offset problem???\n",rec->chunk.keys_dex);
+			status = 250;
+		} else if(rec->status == PIPE_REC_SHORT) {
+			printf("error: track record %i is truncated!\n",rec->tdex);
+			status = 250;
+		} else if(rec->status == PIPE_REC_TRACK && !status) {
+			memcpy(&chunkrunner,&rec->chunk,sizeof(FPL_TRACK_CHUNK));
+			memcpy(keyrunner,rec->keys,sizeof(unsigned int) * rec->real_keys);
+			real_keys = rec->real_keys;
+			if(process_track(outtie,rec->ofz,rec->tdex)) status = 253;
+		}
+
+		// after an output error, keep draining so the reader can finish
+		bool more = (rec->status == PIPE_REC_TRACK);
+		spsc_release(&pipe_recs);
+		if(!more) break;
+	}
+
+	reader.join();
+	spsc_free(&pipe_recs);
+
+	return status;
+}
+
+
+/*
+
+Escape cache
+
+Values in the string table are shared between tracks (album, artist, genre, codec...),
+so each (offset, mode) pair only needs escaping once per run. Escaped strings are kept
+in an arena; strings longer than ESC_CACHE_MAXLEN, or anything past ESC_CACHE_MAXMEM,
+are escaped into the caller's scratch buffer instead.
+
+*/
+
+static unsigned int esc_hash(unsigned int ofz, int mode) {
+	unsigned int h = (ofz * 2654435761U) ^ (unsigned int)mode;
+	return h ^ (h >> 16);
+}
+
+// copy an escaped string into the arena; returns NULL on allocation failure
+static const char* esc_arena_store(const char *str, size_t len) {
+
+	if(esc_arena_pos + len + 1 > ESC_ARENA_BLOCK) {
+		char **nlist = (char**)realloc(esc_arena,sizeof(char*) * (esc_arena_cnt + 1));
+		if(nlist == NULL) return NULL;
+		esc_arena = nlist;
+		if((esc_arena[esc_arena_cnt] = (char*)malloc(ESC_ARENA_BLOCK)) == NULL) return NULL;
+		esc_arena_cnt++;
+		esc_arena_pos = 0;
+	}
+
+	char *dest = esc_arena[esc_arena_cnt - 1] + esc_arena_pos;
+	memcpy(dest,str,len + 1);
+	esc_arena_pos += len + 1;
+	esc_cache_mem += len + 1;
+
+	return dest;
+}
+
+// double the hash table size (or create it); returns false on allocation failure
+static bool esc_cache_grow() {
+
+	unsigned int nsz = esc_cache_sz ? esc_cache_sz * 2 : 4096;
+	FPL_ESC_ENTRY *ntab = (FPL_ESC_ENTRY*)malloc(sizeof(FPL_ESC_ENTRY) * nsz);
+	if(ntab == NULL) return false;
+
+	for(unsigned int i = 0; i < nsz; i++) ntab[i].ofz = FPL_NO_OFZ;
+
+	for(unsigned int i = 0; i < esc_cache_sz; i++) {
+		if(esc_cache[i].ofz == FPL_NO_OFZ) continue;
+		unsigned int h = esc_hash(esc_cache[i].ofz,esc_cache[i].mode) & (nsz - 1);
+		while(ntab[h].ofz != FPL_NO_OFZ) h = (h + 1) & (nsz - 1);
+		ntab[h] = esc_cache[i];
+	}
+
+	free(esc_cache);
+	esc_cache = ntab;
+	esc_cache_sz = nsz;
+
+	return true;
+}
+
+// returns the escaped form of the string at dataprime+ofz, escaping it only on first use.
+// if scratch is NULL, strings that bypass the cache return NULL instead of being escaped
+const char* escape_cached(unsigned int ofz, int mode, char *scratch, int scratchsz) {
+
+	char escbuf[ESC_CACHE_MAXLEN * 6 + 8];	// worst case expansion is json_escape_str's \u00XX
+
+	if(ofz == FPL_NO_OFZ || ofz >= data_sz) return nullstring;
+
+	// lookup
+	if(esc_cache_sz) {
+		unsigned int h = esc_hash(ofz,mode) & (esc_cache_sz - 1);
+		while(esc_cache[h].ofz != FPL_NO_OFZ) {
+			if(esc_cache[h].ofz == ofz && esc_cache[h].mode == mode) return esc_cache[h].str;
+			h = (h + 1) & (esc_cache_sz - 1);
+		}
+	}
+
+	char *instr = dataprime + ofz;
+
+	// too long or cache full: escape directly into the caller's buffer
+	if(strlen(instr) > ESC_CACHE_MAXLEN || esc_cache_mem >= ESC_CACHE_MAXMEM) {
+		if(scratch == NULL)          return NULL;
+		else if(mode == ESCMODE_XML) xml_escape_str(instr,scratch,scratchsz);
+		else if(mode == ESCMODE_JSON) json_escape_str(instr,scratch,scratchsz);
+		else                         escape_str(instr,scratch,scratchsz);
+		return scratch;
+	}
+
+	if(mode == ESCMODE_XML)       xml_escape_str(instr,escbuf,sizeof(escbuf) - 8);
+	else if(mode == ESCMODE_JSON) json_escape_str(instr,escbuf,sizeof(escbuf) - 8);
+	else                          escape_str(instr,escbuf,sizeof(escbuf) - 8);
+
+	// keep load factor under 1/2
+	const char *stored = NULL;
+	if((esc_cache_used + 1) * 2 <= esc_cache_sz || esc_cache_grow()) {
+		stored = esc_arena_store(escbuf,strlen(escbuf));
+	}
+
+	if(stored == NULL) {
+		if(scratch == NULL) return NULL;
+		strncpy(scratch,escbuf,scratchsz - 1);
+		scratch[scratchsz - 1] = NULL;
+		return scratch;
+	}
+
+	unsigned int h = esc_hash(ofz,mode) & (esc_cache_sz - 1);
+	while(esc_cache[h].ofz != FPL_NO_OFZ) h = (h + 1) & (esc_cache_sz - 1);
+	esc_cache[h].ofz  = ofz;
+	esc_cache[h].mode = mode;
+	esc_cache[h].str  = stored;
+	esc_cache_used++;
+
+	return stored;
+}
+
+// escaped value of a track attribute (via the escape cache)
+const char* esc_attrib(char *astring, int listlen, int mode, char *scratch, int scratchsz) {
+	return escape_cached(get_attrib_ofz(astring,listlen),mode,scratch,scratchsz);
+}
+
+void esc_cache_free() {
+	for(int i = 0; i < esc_arena_cnt; i++) free(esc_arena[i]);
+	free(esc_arena);
+	free(esc_cache);
+	esc_arena = NULL;
+	esc_arena_cnt = 0;
+	esc_arena_pos = ESC_ARENA_BLOCK;
+	esc_cache = NULL;
+	esc_cache_sz = esc_cache_used = 0;
+	esc_cache_mem = 0;
+}
+
+
+/*
+
+Typed attribute decoding
+
+Track/disc numbers ("3", "03", "3/12", "1.03"), dates ("2004", "2004-05",
+"2004-05-06", "2004-05-06T12:30:00") and plain integers (bitrate, samplerate)
+are parsed by hand into FPL_TYPED values. Like escaped strings, the result only
+depends on the string, so it is memoized per (offset, kind) for the whole run.
+
+*/
+
+// days since 1970-01-01 of a proleptic Gregorian date
+static long long days_from_civil(int y, unsigned int m, unsigned int d) {
+	y -= (m <= 2);
+	long long    era = (y >= 0 ? y : y - 399) / 400;
+	unsigned int yoe = (unsigned int)(y - era * 400);
+	unsigned int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	unsigned int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (long long)doe - 719468;
+}
+
+// read up to maxdigits decimal digits; returns the number of digits read
+static int parse_digits(const char **sp, int maxdigits, long long *out) {
+	const char *s = *sp;
+	long long   v = 0;
+	int         n = 0;
+
+	while(n < maxdigits && *s >= '0' && *s <= '9') {
+		v = v * 10 + (*s++ - '0');
+		n++;
+	}
+
+	*sp = s;
+	*out = v;
+	return n;
+}
+
+// "3", "03", "3/12" (track 3 of 12), "1.03" (disc 1, track 3)
+static void parse_tracknum(const char *s, FPL_TYPED *t) {
+	long long v, v2;
+
+	while(*s == ' ' || *s == '\t') s++;
+	if(!parse_digits(&s,9,&v)) return;
+
+	if(*s == '/') {
+		s++;
+		if(parse_digits(&s,9,&v2)) t->total = (int)v2;
+	} else if(*s == '.' && s[1] >= '0' && s[1] <= '9') {
+		s++;
+		t->disc = (int)v;
+		parse_digits(&s,9,&v);
+	}
+
+	t->value = v;
+	t->valid = true;
+}
+
+// "2004", "2004-05", "2004-05-06", "2004-05-06T12:30[:00]" ('/' and '.' work
+// as date separators too); the time of day is taken as UTC
+static void parse_date(const char *s, FPL_TYPED *t) {
+	long long y, mon = 1, d = 1, h = 0, mi = 0, sec = 0, v;
+
+	while(*s == ' ' || *s == '\t') s++;
+	if(parse_digits(&s,4,&y) != 4) return;
+
+	if((*s == '-' || *s == '/' || *s == '.') && s[1] >= '0' && s[1] <= '9') {
+		s++;
+		if(!parse_digits(&s,2,&v) || v < 1 || v > 12) return;
+		mon = v;
+
+		if((*s == '-' || *s == '/' || *s == '.') && s[1] >= '0' && s[1] <= '9') {
+			s++;
+			if(!parse_digits(&s,2,&v) || v < 1 || v > 31) return;
+			d = v;
+
+			if((*s == 'T' || *s == ' ') && s[1] >= '0' && s[1] <= '9') {
+				s++;
+				if(parse_digits(&s,2,&h) == 2 && *s == ':' && h < 24) {
+					s++;
+					if(parse_digits(&s,2,&mi) != 2 || mi > 59) mi = 0;
+					if(*s == ':') {
+						s++;
+						if(parse_digits(&s,2,&sec) != 2 || sec > 60) sec = 0;
+					}
+				} else {
+					h = 0;
+				}
+			}
+		}
+	}
+
+	t->days  = days_from_civil((int)y,(unsigned int)mon,(unsigned int)d);
+	t->value = t->days * 86400 + h * 3600 + mi * 60 + sec;
+	t->valid = true;
+}
+
+// "320", "44100", "320 kbps"
+static void parse_int(const char *s, FPL_TYPED *t) {
+	while(*s == ' ' || *s == '\t') s++;
+	if(parse_digits(&s,18,&t->value)) t->valid = true;
+}
+
+// double the memo table size (or create it); returns false on allocation failure
+static bool typed_cache_grow() {
+
+	unsigned int nsz = typed_cache_sz ? typed_cache_sz * 2 : 1024;
+	FPL_TYPED_ENTRY *ntab = (FPL_TYPED_ENTRY*)malloc(sizeof(FPL_TYPED_ENTRY) * nsz);
+	if(ntab == NULL) return false;
+
+	for(unsigned int i = 0; i < nsz; i++) ntab[i].ofz = FPL_NO_OFZ;
+
+	for(unsigned int i = 0; i < typed_cache_sz; i++) {
+		if(typed_cache[i].ofz == FPL_NO_OFZ) continue;
+		unsigned int h = esc_hash(typed_cache[i].ofz,typed_cache[i].kind) & (nsz - 1);
+		while(ntab[h].ofz != FPL_NO_OFZ) h = (h + 1) & (nsz - 1);
+		ntab[h] = typed_cache[i];
+	}
+
+	free(typed_cache);
+	typed_cache = ntab;
+	typed_cache_sz = nsz;
+
+	return true;
+}
+
+// decoded value of the string at dataprime+ofz, parsed only on first use.
+// the returned pointer is only good until the next call
+const FPL_TYPED* typed_value(unsigned int ofz, int kind) {
+
+	static FPL_TYPED none;		// missing attribute (never valid)
+	static FPL_TYPED uncached;	// result when the memo table can't grow
+
+	if(ofz == FPL_NO_OFZ || ofz >= data_sz) return &none;
+
+	if(typed_cache_sz) {
+		unsigned int h = esc_hash(ofz,kind) & (typed_cache_sz - 1);
+		while(typed_cache[h].ofz != FPL_NO_OFZ) {
+			if(typed_cache[h].ofz == ofz && typed_cache[h].kind == kind) return &typed_cache[h].val;
+			h = (h + 1) & (typed_cache_sz - 1);
+		}
+	}
+
+	FPL_TYPED t;
+	memset(&t,0,sizeof(t));
+
+	switch(kind) {
+		case TYPED_NUMBER:	parse_tracknum(dataprime + ofz,&t); break;
+		case TYPED_DATE:	parse_date(dataprime + ofz,&t); break;
+		default:			parse_int(dataprime + ofz,&t); break;
+	}
+
+	// keep load factor under 1/2
+	if((typed_cache_used + 1) * 2 > typed_cache_sz && !typed_cache_grow()) {
+		uncached = t;
+		return &uncached;
+	}
+
+	unsigned int h = esc_hash(ofz,kind) & (typed_cache_sz - 1);
+	while(typed_cache[h].ofz != FPL_NO_OFZ) h = (h + 1) & (typed_cache_sz - 1);
+	typed_cache[h].ofz  = ofz;
+	typed_cache[h].kind = kind;
+	typed_cache[h].val  = t;
+	typed_cache_used++;
+
+	return &typed_cache[h].val;
+}
+
+// decoded value of a track attribute
+const FPL_TYPED* typed_attrib(const char *astring, int listlen, int kind) {
+	return typed_value(get_attrib_ofz((char*)astring,listlen),kind);
+}
+
+void typed_cache_free() {
+	free(typed_cache);
+	typed_cache = NULL;
+	typed_cache_sz = typed_cache_used = 0;
+}
+
+
+/*
+
+Filename remapping (-remap)
+
+*/
+
+// load remap rules from rmfile; returns non-zero on error
+int load_remap(char *rmfile) {
+
+	FILE *rmf;
+	char  lbuf[1100];
+	int   lnum = 0;
+
+	if((rmf = fopen(rmfile,"r")) == NULL) {
+		printf("error: unable to open remap file \"%s\"!\n\n",rmfile);
+		return 1;
+	}
+
+	while(fgets(lbuf,sizeof(lbuf),rmf)) {
+		lnum++;
+
+		// strip line endings
+		int ll = strlen(lbuf);
+		while(ll > 0 && (lbuf[ll-1] == '\n' || lbuf[ll-1] == '\r')) lbuf[--ll] = NULL;
+
+		if(ll == 0 || lbuf[0] == '#') continue;
+
+		char *sep = strchr(lbuf,'|');
+		if(sep == NULL || sep == lbuf || (sep - lbuf) >= 512 || strlen(sep + 1) >= 512) {
+			printf("error: remap file \"%s\", line %i: expected old_prefix|new_prefix\n\n",rmfile,lnum);
+			fclose(rmf);
+			return 1;
+		}
+
+		FPL_REMAP_RULE *nrules = (FPL_REMAP_RULE*)realloc(remap_rules,sizeof(FPL_REMAP_RULE) * (remap_count + 1));
+		if(nrules == NULL) {
+			printf("error allocating memory for remap rules!\n");
+			fclose(rmf);
+			return 1;
+		}
+		remap_rules = nrules;
+
+		*sep = NULL;
+		strcpy(remap_rules[remap_count].from,lbuf);
+		strcpy(remap_rules[remap_count].to,sep + 1);
+		remap_rules[remap_count].from_len = strlen(lbuf);
+		remap_count++;
+	}
+
+	fclose(rmf);
+
+	return 0;
+}
+
+// apply the first matching remap rule to path (in place); returns 1 if remapped
+int remap_path(char *path, int pathsz) {
+
+	char tbuf[1024];
+
+	for(int i = 0; i < remap_count; i++) {
+		FPL_REMAP_RULE *rr = &remap_rules[i];
+		int ii;
+
+		for(ii = 0; ii < rr->from_len; ii++) {
+			if(tolower(path[ii]) != tolower(rr->from[ii])) break;
+		}
+		if(ii < rr->from_len) continue;
+
+		snprintf(tbuf,sizeof(tbuf),"%s%s",rr->to,path + rr->from_len);
+		strncpy(path,tbuf,pathsz - 1);
+		path[pathsz - 1] = NULL;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+// enumerate the attributes of the current track (chunkrunner/keyrunner) into trackrunner;
+// field names and values point straight into the string table. returns attribute count
+int decode_attribs() {
+
+	int trx_dex = 0;
+
+	// Enumerate primary keys, which contain a key_value->field_name pair (hence, the x2 multiplier).
+	// After all the key_value->field_name pairs is a list of values which is preceeded by the
+	// key_value which is equal to key_primary's value
+	for(int ii = 0; ii < (chunkrunner.key_primary * 2); ii += 2) {
+		// key value
+		trackrunner[trx_dex].key = keyrunner[ii];
+		// field name
+		trackrunner[trx_dex].field_name = dataprime + keyrunner[1+ii];
+		// value
+		trackrunner[trx_dex].value_ofz = keyrunner[1+trackrunner[trx_dex].key+(chunkrunner.key_primary * 2)];
+		trackrunner[trx_dex].value = dataprime + trackrunner[trx_dex].value_ofz;
+		trx_dex++;
+	}
+
+	// enumerate secondary keys, which are field_name->value pairs, with NO key_value, as they are usually
+	// additional data that is not used as often
+	for(int ii = 0; ii < (chunkrunner.key_second * 2); ii += 2) {
+		// set the key value as -1 to represent UNDEFINED
+		trackrunner[trx_dex].key = -1; 
+		// field name
+		trackrunner[trx_dex].field_name = dataprime + keyrunner[ii+chunkrunner.key_sec_offset];
+		// value
+		trackrunner[trx_dex].value_ofz = keyrunner[1+ii+chunkrunner.key_sec_offset];
+		trackrunner[trx_dex].value = dataprime + trackrunner[trx_dex].value_ofz;
+		trx_dex++;
+	}
+
+	return trx_dex;
+}
+
+
+// read the track record at the current file position into chunkrunner/keyrunner.
+// tdex is the track's playlist index (for verbose output). returns non-zero on error
+int read_track(FILE *fplfile, int tdex) {
+
+	fpos_t	fploffset;
+	double	duration_conv;
+	int		attrib_count;
+
+	fgetpos(fplfile, &fploffset);
+	if(verbose) printf("trackrunner: Reading track info at: index < %i > / start offset < 0x%08X >...\n",tdex,fploffset);
+	
+	fread((void*)&chunkrunner,sizeof(FPL_TRACK_CHUNK),1,fplfile);
+	fgetpos(fplfile, &fploffset);
+	if(verbose) printf("\ttrackrunner: done. ending offset < 0x%08X >.\n",fploffset);
+
+	// display chunkrunner results
+
+	// tricky casting! MSVC won't let us do a char to double cast... so we'll show him who's boss...
+	memcpy((void*)&duration_conv,chunkrunner.duration_dbl,8);
+
+
+	if(verbose) {
+		printf("\tchunkrunner:\n");
+		printf("\t  unk1 = %i\n",chunkrunner.unk1);
+		printf("\t  String table offset = %i\n",chunkrunner.file_ofz);
+		printf("\t  Subsong index = %i\n",chunkrunner.subsong);
+		printf("\t  Track filesize = %i bytes\n",chunkrunner.fsize);
+		printf("\t  unk2 = %i  [ 0x%08X ]\n",chunkrunner.unk2,chunkrunner.unk2);
+		printf("\t  unk3 = %i  [ 0x%08X ]\n",chunkrunner.unk3,chunkrunner.unk3);
+		printf("\t  unk4 = %i  [ 0x%08X ]\n",chunkrunner.unk4,chunkrunner.unk4);
+		printf("\t  Track duration = %0.02f seconds\n",duration_conv);
+		printf("\t  ReplayGain, album = %0.02f dB\n",chunkrunner.rpg_album);
+		printf("\t  ReplayGain, track = %0.02f dB\n",chunkrunner.rpg_track);
+		printf("\t  ReplayGain, album peak = %0.02f dB\n",chunkrunner.rpk_album);
+		printf("\t  ReplayGain, track peak = %0.02f dB\n",chunkrunner.rpk_track);
+		printf("\t  --------------\n");
+		printf("\t  keys_dex = %i, key_primary = %i, key_second = %i, key_sec_offset = %i\n\n",chunkrunner.keys_dex,chunkrunner.key_primary,chunkrunner.key_second,chunkrunner.key_sec_offset);
+	}
+
+	// attribute count is primary keys (key_primary) + secondary keys (key_second)
+	attrib_count = chunkrunner.key_primary + chunkrunner.key_second;
+	if(verbose) printf("\ttrackrunner determined this track has %i attribute fields.\n",attrib_count);
+	
+	// keys_dex sanity check
+	if(chunkrunner.keys_dex > 512) {
+		printf("\n\n\n>>>> ERROR: keys_dex > 512 (keys_dex = %i). Offset problem???\n",chunkrunner.keys_dex);
+		return 250;
+	}
+
+	// read in key values from file
+	fgetpos(fplfile, &fploffset);
+
+	// since we've already read 3 of the "keys" (key_primary,key_second, and key_sec_offset), we subtract 3
+	real_keys = chunkrunner.keys_dex - 3;
+
+	if(verbose) printf("\tkeyrunner: reading %i (adjusted) values, starting offset = 0x%08X\n",real_keys,fploffset);
+	fread((void*)&keyrunner,sizeof(unsigned int),real_keys,fplfile);
+	fgetpos(fplfile, &fploffset);
+	if(verbose) printf("\tkeyrunner: ending offset = 0x%08X\n",fploffset);
+
+	// list key values
+
+	/*
+	if(verbose) {
+		printf("\tkeyrunner:\n");
+		for(int ii = 0; ii < real_keys; ii++) {
+			printf("\t  key(%i) = %i\n",ii,keyrunner[ii]);
+		}
+		printf("\tkeyrunner done.\n");
+	}
+	*/
+
+	return 0;
+}
+
+
+// run the current track (chunkrunner/keyrunner) through -where, -sort and the output
+// function. recofz is the record's file offset. returns non-zero on error
+int process_track(FILE *outtie, long recofz, int tdex) {
+
+	char	tdata_fname[1024];
+	int		trx_dex;
+
+	// display data
+
+	strcpy(tdata_fname,(char*)(dataprime + chunkrunner.file_ofz)); // get filename string
+	if(opt_remap) remap_path(tdata_fname,sizeof(tdata_fname));
+
+	// attributes are decoded on first use, so tracks rejected by a -where test
+	// on the numeric fields never have their key array walked
+	trx_dex = -1;
+
+	if(where_count && !where_eval(tdata_fname,&trx_dex)) {
+		if(verbose) printf("\ttrackrunner: track rejected by -where filter\n\n\n");
+		return 0;
+	}
+
+	if(trx_dex < 0) trx_dex = decode_attribs();
+	if(verbose) printf("\ttrackrunner enumerated %i attributes (expected %i)\n",trx_dex,chunkrunner.key_primary + chunkrunner.key_second);
+
+	if(verbose) {
+		printf("\ttrackrunner discovered track data!\n");
+		printf("\t  Track filename = \"%s\"\n",tdata_fname);		
+		
+		for(int ii = 0; ii < trx_dex; ii++) {
+			printf("\t  \"%s\" (key = %i) = \"%s\"\n",trackrunner[ii].field_name,trackrunner[ii].key,trackrunner[ii].value);
+		}
+	}
+
+
+	// sorted output: keep only the sort key and record offset for now
+	if(sort_count) {
+		if(sort_add(recofz,tdex,tdata_fname,trx_dex)) return 1;
+		if(verbose) printf("\t <<< Sort key stored for this track!\n\n\n");
+		return 0;
+	}
+
+	if(verbose) printf("\ttrackrunner: calling %s output function...\n",out_lut[outmode].desc);
+	out_lut[outmode].outfunc(outtie,tdata_fname,trx_dex);
+	if(verbose) printf("\t <<< Finished for this track!\n\n\n");
+
+	return 0;
+}
+
+
+/*
+
+Track filter (-where)
+
+The expression is parsed once by a small recursive-descent parser into a postfix
+program of FPL_WHERE_OP instructions, which where_eval runs against each track
+before any escaping or formatting takes place.
+
+*/
+
+static char *wp_pos;		// parser position
+static char *wp_expr;		// full expression (for error messages)
+
+static int where_error(const char *msg) {
+	printf("error: -where: %s at position %i in \"%s\"\n\n",msg,(int)(wp_pos - wp_expr),wp_expr);
+	return 1;
+}
+
+static void wp_skipws() {
+	while(*wp_pos == ' ' || *wp_pos == '\t') wp_pos++;
+}
+
+// match keyword kw (case-insensitive, followed by a non-word char); consumes it on match
+static bool wp_keyword(const char *kw) {
+	int kl = strlen(kw);
+	for(int i = 0; i < kl; i++) {
+		if(tolower(wp_pos[i]) != kw[i]) return false;
+	}
+	if(isalnum((unsigned char)wp_pos[kl]) || wp_pos[kl] == '_') return false;
+	wp_pos += kl;
+	return true;
+}
+
+// read a quoted string or bare word into buf; returns length, or -1 on error
+static int wp_token(char *buf, int bufsz, bool is_field) {
+
+	int tl = 0;
+
+	wp_skipws();
+
+	if(*wp_pos == '"' || *wp_pos == '\'') {
+		char q = *wp_pos++;
+		while(*wp_pos && *wp_pos != q) {
+			if(tl >= bufsz - 1) return -1;
+			buf[tl++] = *wp_pos++;
+		}
+		if(*wp_pos != q) return -1;
+		wp_pos++;
+	} else {
+		while(*wp_pos && *wp_pos != ' ' && *wp_pos != '\t' && *wp_pos != '(' && *wp_pos != ')') {
+			// field names end at the operator
+			if(is_field && strchr("=!<>~^",*wp_pos)) break;
+			if(tl >= bufsz - 1) return -1;
+			buf[tl++] = *wp_pos++;
+		}
+	}
+
+	buf[tl] = NULL;
+
+	return tl;
+}
+
+// map a field name to WHERE_FIELD_* (anything that isn't a track chunk field is an attribute)
+int lookup_field(const char *fname) {
+	if(!fpl_strcmpi(fname,"filename"))  return WHERE_FIELD_FILENAME;
+	if(!fpl_strcmpi(fname,"duration"))  return WHERE_FIELD_DURATION;
+	if(!fpl_strcmpi(fname,"fsize"))     return WHERE_FIELD_FSIZE;
+	if(!fpl_strcmpi(fname,"subsong"))   return WHERE_FIELD_SUBSONG;
+	if(!fpl_strcmpi(fname,"rg_album"))  return WHERE_FIELD_RPG_ALBUM;
+	if(!fpl_strcmpi(fname,"rg_track"))  return WHERE_FIELD_RPG_TRACK;
+	if(!fpl_strcmpi(fname,"rpk_album")) return WHERE_FIELD_RPK_ALBUM;
+	if(!fpl_strcmpi(fname,"rpk_track")) return WHERE_FIELD_RPK_TRACK;
+	return WHERE_FIELD_ATTRIB;
+}
+
+static FPL_WHERE_OP* where_emit(int opcode) {
+
+	FPL_WHERE_OP *nprog = (FPL_WHERE_OP*)realloc(where_prog,sizeof(FPL_WHERE_OP) * (where_count + 1));
+	if(nprog == NULL) return NULL;
+
+	where_prog = nprog;
+	memset(&where_prog[where_count],0,sizeof(FPL_WHERE_OP));
+	where_prog[where_count].opcode = opcode;
+
+	return &where_prog[where_count++];
+}
+
+static int wp_or();
+
+// comparison: field op value
+static int wp_compare() {
+
+	char fname[128];
+	char lit[512];
+	int  cmp;
+	FPL_WHERE_OP *op;
+
+	if(wp_token(fname,sizeof(fname),true) <= 0) return where_error("expected field name");
+
+	wp_skipws();
+	if(!strncmp(wp_pos,"==",2))      { cmp = WHERE_CMP_EQ;       wp_pos += 2; }
+	else if(!strncmp(wp_pos,"!=",2)) { cmp = WHERE_CMP_NE;       wp_pos += 2; }
+	else if(!strncmp(wp_pos,"<=",2)) { cmp = WHERE_CMP_LE;       wp_pos += 2; }
+	else if(!strncmp(wp_pos,">=",2)) { cmp = WHERE_CMP_GE;       wp_pos += 2; }
+	else if(!strncmp(wp_pos,"^=",2)) { cmp = WHERE_CMP_PREFIX;   wp_pos += 2; }
+	else if(*wp_pos == '=')          { cmp = WHERE_CMP_EQ;       wp_pos++; }
+	else if(*wp_pos == '<')          { cmp = WHERE_CMP_LT;       wp_pos++; }
+	else if(*wp_pos == '>')          { cmp = WHERE_CMP_GT;       wp_pos++; }
+	else if(*wp_pos == '~')          { cmp = WHERE_CMP_CONTAINS; wp_pos++; }
+	else return where_error("expected comparison operator");
+
+	int ll = wp_token(lit,sizeof(lit),false);
+	if(ll < 0) return where_error("bad value");
+
+	if((op = where_emit(WHERE_OP_TEST)) == NULL) return where_error("out of memory");
+
+	op->cmp = cmp;
+	strcpy(op->str,lit);
+	op->str_len = ll;
+
+	// numeric literal?
+	char *endp;
+	op->num = strtod(lit,&endp);
+	op->numeric = (ll > 0 && *endp == NULL);
+
+	op->field = lookup_field(fname);
+	if(op->field == WHERE_FIELD_ATTRIB) strcpy(op->name,fname);
+
+	if(op->field != WHERE_FIELD_ATTRIB && op->field != WHERE_FIELD_FILENAME && !op->numeric) {
+		return where_error("numeric field compared to non-numeric value");
+	}
+
+	return 0;
+}
+
+// unary: not unary | ( or ) | comparison
+static int wp_unary() {
+
+	wp_skipws();
+
+	if(*wp_pos == '!' && wp_pos[1] != '=') {
+		wp_pos++;
+		if(wp_unary()) return 1;
+		return where_emit(WHERE_OP_NOT) ? 0 : where_error("out of memory");
+	} else if(wp_keyword("not")) {
+		if(wp_unary()) return 1;
+		return where_emit(WHERE_OP_NOT) ? 0 : where_error("out of memory");
+	} else if(*wp_pos == '(') {
+		wp_pos++;
+		if(wp_or()) return 1;
+		wp_skipws();
+		if(*wp_pos != ')') return where_error("expected ')'");
+		wp_pos++;
+		return 0;
+	}
+
+	return wp_compare();
+}
+
+static int wp_and() {
+
+	if(wp_unary()) return 1;
+
+	for(;;) {
+		wp_skipws();
+		if(!strncmp(wp_pos,"&&",2)) wp_pos += 2;
+		else if(!wp_keyword("and")) return 0;
+
+		if(wp_unary()) return 1;
+		if(!where_emit(WHERE_OP_AND)) return where_error("out of memory");
+	}
+}
+
+static int wp_or() {
+
+	if(wp_and()) return 1;
+
+	for(;;) {
+		wp_skipws();
+		if(!strncmp(wp_pos,"||",2)) wp_pos += 2;
+		else if(!wp_keyword("or")) return 0;
+
+		if(wp_and()) return 1;
+		if(!where_emit(WHERE_OP_OR)) return where_error("out of memory");
+	}
+}
+
+// compile expr into where_prog; returns non-zero on error
+int where_compile(char *expr) {
+
+	wp_expr = wp_pos = expr;
+
+	// multiple -where options are combined with 'and'
+	bool chain = (where_count > 0);
+
+	if(wp_or()) return 1;
+
+	wp_skipws();
+	if(*wp_pos) return where_error("unexpected input");
+
+	if(chain && !where_emit(WHERE_OP_AND)) return where_error("out of memory");
+
+	// where_eval's stack is fixed: each test pushes a result, and/or pop one
+	int depth = 0, maxdepth = 0;
+	for(int i = 0; i < where_count; i++) {
+		if(where_prog[i].opcode == WHERE_OP_TEST) depth++;
+		else if(where_prog[i].opcode != WHERE_OP_NOT) depth--;
+		if(depth > maxdepth) maxdepth = depth;
+	}
+	if(maxdepth > WHERE_STACK_MAX) {
+		printf("error: -where: expression nested too deeply (needs %i stack slots, the limit is %i)\n\n",maxdepth,WHERE_STACK_MAX);
+		return 1;
+	}
+
+	return 0;
+}
+
+// case-insensitive substring search
+static bool where_contains(const char *hay, const char *needle, int nlen) {
+	if(nlen == 0) return true;
+	for(; *hay; hay++) {
+		int i;
+		for(i = 0; i < nlen && hay[i]; i++) {
+			if(tolower((unsigned char)hay[i]) != tolower((unsigned char)needle[i])) break;
+		}
+		if(i == nlen) return true;
+	}
+	return false;
+}
+
+static bool where_test(FPL_WHERE_OP *op, char *trackfile, int *listlen) {
+
+	double fval;
+	const char *sval = NULL;
+
+	switch(op->field) {
+		case WHERE_FIELD_DURATION:	memcpy((void*)&fval,chunkrunner.duration_dbl,8); break;
+		case WHERE_FIELD_FSIZE:		fval = chunkrunner.fsize; break;
+		case WHERE_FIELD_SUBSONG:	fval = chunkrunner.subsong; break;
+		case WHERE_FIELD_RPG_ALBUM:	fval = chunkrunner.rpg_album; break;
+		case WHERE_FIELD_RPG_TRACK:	fval = chunkrunner.rpg_track; break;
+		case WHERE_FIELD_RPK_ALBUM:	fval = chunkrunner.rpk_album; break;
+		case WHERE_FIELD_RPK_TRACK:	fval = chunkrunner.rpk_track; break;
+		case WHERE_FIELD_FILENAME:	sval = trackfile; break;
+		default:
+			// decode attributes on first use
+			if(*listlen < 0) *listlen = decode_attribs();
+			sval = get_attrib(op->name,*listlen);
+			break;
+	}
+
+	// string field compared to a number: convert the field
+	if(sval != NULL && op->numeric && op->cmp != WHERE_CMP_CONTAINS && op->cmp != WHERE_CMP_PREFIX) {
+		char *endp;
+		fval = strtod(sval,&endp);
+		if(endp == sval) return (op->cmp == WHERE_CMP_NE);	// missing/non-numeric value
+		sval = NULL;
+	}
+
+	if(sval == NULL) {
+		switch(op->cmp) {
+			case WHERE_CMP_EQ:	return fval == op->num;
+			case WHERE_CMP_NE:	return fval != op->num;
+			case WHERE_CMP_LT:	return fval <  op->num;
+			case WHERE_CMP_LE:	return fval <= op->num;
+			case WHERE_CMP_GT:	return fval >  op->num;
+			case WHERE_CMP_GE:	return fval >= op->num;
+			default:			return false;
+		}
+	}
+
+	int rr;
+	switch(op->cmp) {
+		case WHERE_CMP_CONTAINS:	return where_contains(sval,op->str,op->str_len);
+		case WHERE_CMP_PREFIX:
+			for(rr = 0; rr < op->str_len; rr++) {
+				if(tolower((unsigned char)sval[rr]) != tolower((unsigned char)op->str[rr])) return false;
+			}
+			return true;
+		default:
+			break;
+	}
+
+	// case-insensitive ordering
+	const char *aa = sval, *bb = op->str;
+	while(*aa && tolower((unsigned char)*aa) == tolower((unsigned char)*bb)) { aa++; bb++; }
+	rr = tolower((unsigned char)*aa) - tolower((unsigned char)*bb);
+
+	switch(op->cmp) {
+		case WHERE_CMP_EQ:	return rr == 0;
+		case WHERE_CMP_NE:	return rr != 0;
+		case WHERE_CMP_LT:	return rr <  0;
+		case WHERE_CMP_LE:	return rr <= 0;
+		case WHERE_CMP_GT:	return rr >  0;
+		case WHERE_CMP_GE:	return rr >= 0;
+		default:			return false;
+	}
+}
+
+// run the -where program against the current track. listlen is the decoded attribute
+// count, or -1 if attributes have not been decoded yet (updated if decoding happens)
+bool where_eval(char *trackfile, int *listlen) {
+
+	bool stack[WHERE_STACK_MAX];	// depth checked by where_compile
+	int  sp = 0;
+
+	for(int i = 0; i < where_count; i++) {
+		FPL_WHERE_OP *op = &where_prog[i];
+		switch(op->opcode) {
+			case WHERE_OP_TEST:
+				stack[sp++] = where_test(op,trackfile,listlen);
+				break;
+			case WHERE_OP_AND:
+				sp--;
+				stack[sp-1] = stack[sp-1] && stack[sp];
+				break;
+			case WHERE_OP_OR:
+				sp--;
+				stack[sp-1] = stack[sp-1] || stack[sp];
+				break;
+			case WHERE_OP_NOT:
+				stack[sp-1] = !stack[sp-1];
+				break;
+		}
+	}
+
+	return sp ? stack[sp-1] : true;
+}
+
+
+/*
+
+Sorted output (-sort)
+
+Each track gets a binary sort key built once while reading: numeric fields are
+stored as order-preserving big-endian doubles, strings are case-folded and
+zero-terminated, and descending fields are bit-inverted. The track index is
+appended so that equal keys keep playlist order, which lets records be compared
+with a single memcmp. Only the key and the record offset are kept; records are
+re-read in sorted order afterwards. When the records outgrow sort_mem_budget they
+are sorted and spilled to a temporary file, and the runs are k-way merged.
+
+*/
+
+// parse a comma separated -sort key list; returns non-zero on error
+int sort_parse(char *keylist) {
+
+	static const struct {
+		const char *name;
+		int         kind;
+	} numeric_attribs[] = {
+		{"tracknumber",TYPED_NUMBER}, {"discnumber",TYPED_NUMBER}, {"totaltracks",TYPED_INT},
+		{"totaldiscs",TYPED_INT}, {"bitrate",TYPED_INT}, {"samplerate",TYPED_INT},
+		{"channels",TYPED_INT}, {"bitspersample",TYPED_INT}, {NULL,0}
+	};
+
+	char *kp = keylist;
+
+	while(*kp) {
+		char *kend = strchr(kp,',');
+		int   kl = kend ? (int)(kend - kp) : (int)strlen(kp);
+
+		if(sort_count >= 16) {
+			printf("error: -sort: too many sort keys (max 16)\n\n");
+			return 1;
+		}
+
+		FPL_SORT_KEY *sk = &sort_keys[sort_count];
+		memset(sk,0,sizeof(FPL_SORT_KEY));
+
+		if(kl > 0 && *kp == '-') {
+			sk->descending = true;
+			kp++;
+			kl--;
+		}
+
+		if(kl <= 0 || kl >= (int)sizeof(sk->name)) {
+			printf("error: -sort: bad sort key list \"%s\"\n\n",keylist);
+			return 1;
+		}
+
+		memcpy(sk->name,kp,kl);
+		sk->name[kl] = NULL;
+		sk->field = lookup_field(sk->name);
+		sk->numeric = (sk->field != WHERE_FIELD_ATTRIB && sk->field != WHERE_FIELD_FILENAME);
+		sk->typed = -1;
+
+		for(int i = 0; sk->field == WHERE_FIELD_ATTRIB && numeric_attribs[i].name; i++) {
+			if(!fpl_strcmpi(sk->name,numeric_attribs[i].name)) {
+				sk->numeric = true;
+				sk->typed = numeric_attribs[i].kind;
+			}
+		}
+
+		sort_count++;
+
+		kp += kl;
+		if(*kp == ',') kp++;
+	}
+
+	if(sort_count == 0) {
+		printf("error: -sort: no sort keys given\n\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+// encode the current track's sort key into kbuf (SORT_KEY_MAX bytes); returns key length.
+// Keys that don't fit are truncated, but the playlist index suffix is always kept
+static int sort_key_build(unsigned char *kbuf, unsigned int tdex, char *trackfile, int listlen) {
+
+	int kl = 0;
+	int room = SORT_KEY_MAX - 4;
+
+	for(int k = 0; k < sort_count; k++) {
+		FPL_SORT_KEY *sk = &sort_keys[k];
+		const char   *sval = NULL;
+		double        fval = 0.0;
+		bool          present = true;
+		int           kstart = kl;
+
+		switch(sk->field) {
+			case WHERE_FIELD_DURATION:	memcpy((void*)&fval,chunkrunner.duration_dbl,8); break;
+			case WHERE_FIELD_FSIZE:		fval = chunkrunner.fsize; break;
+			case WHERE_FIELD_SUBSONG:	fval = chunkrunner.subsong; break;
+			case WHERE_FIELD_RPG_ALBUM:	fval = chunkrunner.rpg_album; break;
+			case WHERE_FIELD_RPG_TRACK:	fval = chunkrunner.rpg_track; break;
+			case WHERE_FIELD_RPK_ALBUM:	fval = chunkrunner.rpk_album; break;
+			case WHERE_FIELD_RPK_TRACK:	fval = chunkrunner.rpk_track; break;
+			case WHERE_FIELD_FILENAME:	sval = trackfile; break;
+			default:
+				if(sk->typed >= 0) {
+					// decoded like the typed output columns: "3/12" and "1.03" -> 3, "" -> missing
+					const FPL_TYPED *tv = typed_attrib(sk->name,listlen,sk->typed);
+					fval = (double)tv->value;
+					present = tv->valid;
+					break;
+				}
+				sval = get_attrib(sk->name,listlen);
+				// same album artist fallback as the output functions
+				if(!fpl_strcmpi(sk->name,"album artist") && strlen(sval) < 3) sval = get_attrib((char*)"artist",listlen);
+				break;
+		}
+
+		if(kl + (sk->numeric ? 9 : 1) > room) break;
+
+		if(sk->numeric) {
+			// order-preserving encoding of an IEEE double, preceded by a presence flag
+			unsigned long long bits;
+			memcpy(&bits,&fval,8);
+			if(bits >> 63) bits = ~bits;
+			else           bits |= (1ULL << 63);
+
+			kbuf[kl++] = present ? 1 : 0;
+			for(int i = 0; i < 8; i++) kbuf[kl++] = present ? (unsigned char)(bits >> (56 - 8*i)) : 0;
+		} else {
+			for(int i = 0; sval[i] && i < SORT_STR_MAX && kl < room - 1; i++) {
+				kbuf[kl++] = (unsigned char)tolower((unsigned char)sval[i]);
+			}
+			kbuf[kl++] = 0;
+		}
+
+		if(sk->descending) {
+			for(int i = kstart; i < kl; i++) kbuf[i] = ~kbuf[i];
+		}
+	}
+
+	// playlist index breaks ties
+	kbuf[kl++] = (unsigned char)(tdex >> 24);
+	kbuf[kl++] = (unsigned char)(tdex >> 16);
+	kbuf[kl++] = (unsigned char)(tdex >> 8);
+	kbuf[kl++] = (unsigned char)tdex;
+
+	return kl;
+}
+
+static inline int sort_cmp_keys(const unsigned char *ka, int kla, const unsigned char *kb, int klb) {
+	int rr = memcmp(ka,kb,(kla < klb) ? kla : klb);
+	return rr ? rr : (kla - klb);
+}
+
+static inline FPL_SORT_REC* sort_rec(size_t aofz) {
+	return (FPL_SORT_REC*)(sort_arena + aofz);
+}
+
+static inline const unsigned char* sort_rec_key(size_t aofz) {
+	return (const unsigned char*)(sort_arena + aofz + sizeof(FPL_SORT_REC));
+}
+
+static bool sort_less(size_t a, size_t b) {
+	return sort_cmp_keys(sort_rec_key(a),sort_rec(a)->keylen,sort_rec_key(b),sort_rec(b)->keylen) < 0;
+}
+
+// sort sort_idx, splitting the work across threads for large inputs
+static void sort_parallel() {
+
+	size_t n = sort_idx_count;
+	int    nthreads = (int)std::thread::hardware_concurrency();
+
+	if(nthreads > 8) nthreads = 8;
+	if(nthreads < 2 || n < 65536) {
+		std::sort(sort_idx,sort_idx + n,sort_less);
+		return;
+	}
+
+	// sort equal slices in parallel...
+	std::vector<size_t>      bounds;
+	std::vector<std::thread> workers;
+
+	for(int t = 0; t <= nthreads; t++) bounds.push_back(n * t / nthreads);
+	workers.reserve(nthreads);
+
+	// a slice that can't get a thread is sorted here instead
+	for(int t = 0; t < nthreads; t++) {
+		size_t lo = bounds[t], hi = bounds[t+1];
+		try {
+			workers.push_back(std::thread([=]() { std::sort(sort_idx + lo,sort_idx + hi,sort_less); }));
+		} catch(...) {
+			std::sort(sort_idx + lo,sort_idx + hi,sort_less);
+		}
+	}
+	for(size_t t = 0; t < workers.size(); t++) workers[t].join();
+
+	// ...then merge neighbouring slices pairwise, also in parallel
+	while(bounds.size() > 2) {
+		std::vector<size_t> nbounds;
+		workers.clear();
+
+		for(size_t t = 0; t + 2 < bounds.size(); t += 2) {
+			size_t lo = bounds[t], mid = bounds[t+1], hi = bounds[t+2];
+			try {
+				workers.push_back(std::thread([=]() { std::inplace_merge(sort_idx + lo,sort_idx + mid,sort_idx + hi,sort_less); }));
+			} catch(...) {
+				std::inplace_merge(sort_idx + lo,sort_idx + mid,sort_idx + hi,sort_less);
+			}
+			nbounds.push_back(lo);
+		}
+		if(bounds.size() % 2 == 0) nbounds.push_back(bounds[bounds.size() - 2]);
+		nbounds.push_back(bounds.back());
+
+		for(size_t t = 0; t < workers.size(); t++) workers[t].join();
+		bounds = nbounds;
+	}
+}
+
+// sort the in-memory records and write them to a temporary run file
+static int sort_spill() {
+
+	FILE *runfile;
+
+	if(sort_idx_count == 0) return 0;
+
+	if((runfile = tmpfile()) == NULL) {
+		printf("error: -sort: unable to create temporary file!\n");
+		return 1;
+	}
+
+	FILE **nruns = (FILE**)realloc(sort_runs,sizeof(FILE*) * (sort_run_count + 1));
+	if(nruns == NULL) {
+		printf("error allocating memory for sort runs!\n");
+		fclose(runfile);
+		return 1;
+	}
+	sort_runs = nruns;
+	sort_runs[sort_run_count++] = runfile;
+
+	if(verbose) printf("sort: spilling run %i (%u tracks)\n",sort_run_count,(unsigned int)sort_idx_count);
+
+	sort_parallel();
+
+	for(size_t i = 0; i < sort_idx_count; i++) {
+		FPL_SORT_REC *sr = sort_rec(sort_idx[i]);
+		long long     ofz = sr->ofz;
+		fwrite(&sr->keylen,sizeof(sr->keylen),1,runfile);
+		fwrite(sort_rec_key(sort_idx[i]),sr->keylen,1,runfile);
+		fwrite(&ofz,sizeof(ofz),1,runfile);
+	}
+
+	if(ferror(runfile)) {
+		printf("error: -sort: unable to write temporary file!\n");
+		return 1;
+	}
+
+	rewind(runfile);
+
+	sort_arena_sz = 0;
+	sort_idx_count = 0;
+
+	return 0;
+}
+
+// store the sort key of the current track; returns non-zero on error
+int sort_add(long ofz, unsigned int tdex, char *trackfile, int listlen) {
+
+	unsigned char kbuf[SORT_KEY_MAX];
+	int           kl = sort_key_build(kbuf,tdex,trackfile,listlen);
+	size_t        recsz = (sizeof(FPL_SORT_REC) + kl + 7) & ~(size_t)7;
+
+	// over budget: spill what we have
+	if(sort_arena_sz + recsz + (sort_idx_count + 1) * sizeof(size_t) > sort_mem_budget) {
+		if(sort_spill()) return 1;
+	}
+
+	if(sort_arena_sz + recsz > sort_arena_cap) {
+		size_t ncap = sort_arena_cap ? sort_arena_cap * 2 : (1024*1024);
+		while(ncap < sort_arena_sz + recsz) ncap *= 2;
+		char *narena = (char*)realloc(sort_arena,ncap);
+		if(narena == NULL) {
+			printf("error allocating memory for sort keys!\n");
+			return 1;
+		}
+		sort_arena = narena;
+		sort_arena_cap = ncap;
+	}
+
+	if(sort_idx_count + 1 > sort_idx_cap) {
+		size_t ncap = sort_idx_cap ? sort_idx_cap * 2 : 16384;
+		size_t *nidx = (size_t*)realloc(sort_idx,sizeof(size_t) * ncap);
+		if(nidx == NULL) {
+			printf("error allocating memory for sort keys!\n");
+			return 1;
+		}
+		sort_idx = nidx;
+		sort_idx_cap = ncap;
+	}
+
+	FPL_SORT_REC *sr = sort_rec(sort_arena_sz);
+	sr->ofz = ofz;
+	sr->keylen = (unsigned short)kl;
+	memcpy(sort_arena + sort_arena_sz + sizeof(FPL_SORT_REC),kbuf,kl);
+
+	sort_idx[sort_idx_count++] = sort_arena_sz;
+	sort_arena_sz += recsz;
+
+	return 0;
+}
+
+// re-read the track record at ofz and pass it to the output function
+static int sort_emit_track(FILE *fplfile, FILE *outtie, long ofz) {
+
+	char tdata_fname[1024];
+
+	if(fseek(fplfile,ofz,SEEK_SET) || read_track(fplfile,-1)) {
+		printf("error: -sort: unable to re-read track record!\n");
+		return 1;
+	}
+
+	strcpy(tdata_fname,(char*)(dataprime + chunkrunner.file_ofz));
+	if(opt_remap) remap_path(tdata_fname,sizeof(tdata_fname));
+
+	out_lut[outmode].outfunc(outtie,tdata_fname,decode_attribs());
+
+	return 0;
+}
+
+// read the next record of a spilled run; returns 1 = record, 0 = end of run, -1 = error
+static int sort_run_next(FPL_SORT_RUN *run) {
+	if(fread(&run->keylen,sizeof(run->keylen),1,run->runfile) != 1) {
+		if(feof(run->runfile) && !ferror(run->runfile)) return 0;
+	} else if(run->keylen <= sizeof(run->key) &&
+	          (run->keylen == 0 || fread(run->key,run->keylen,1,run->runfile) == 1) &&
+	          fread(&run->ofz,sizeof(run->ofz),1,run->runfile) == 1) {
+		return 1;
+	}
+	printf("error: -sort: corrupt or truncated sort run!\n");
+	return -1;
+}
+
+static bool sort_run_less(FPL_SORT_RUN *a, FPL_SORT_RUN *b) {
+	return sort_cmp_keys(a->key,a->keylen,b->key,b->keylen) < 0;
+}
+
+// output all stored tracks in sorted order; returns non-zero on error
+int sort_output(FILE *fplfile, FILE *outtie) {
+
+	int status = 0;
+
+	// everything fit in memory
+	if(sort_run_count == 0) {
+		sort_parallel();
+		for(size_t i = 0; i < sort_idx_count && !status; i++) {
+			status = sort_emit_track(fplfile,outtie,sort_rec(sort_idx[i])->ofz);
+		}
+	} else {
+		// spill the remainder, then k-way merge the runs with a binary heap
+		if(sort_spill()) return 1;
+
+		FPL_SORT_RUN  *runs = (FPL_SORT_RUN*)malloc(sizeof(FPL_SORT_RUN) * sort_run_count);
+		FPL_SORT_RUN **heap = (FPL_SORT_RUN**)malloc(sizeof(FPL_SORT_RUN*) * sort_run_count);
+		int            hsz = 0;
+
+		if(runs == NULL || heap == NULL) {
+			printf("error allocating memory for sort merge!\n");
+			free(runs);
+			free(heap);
+			return 1;
+		}
+
+		if(verbose) printf("sort: merging %i runs\n",sort_run_count);
+
+		for(int r = 0; r < sort_run_count; r++) {
+			runs[r].runfile = sort_runs[r];
+			int rr = sort_run_next(&runs[r]);
+			if(rr < 0) {
+				status = 1;
+				break;
+			} else if(rr == 0) {
+				continue;
+			}
+
+			// sift up
+			int hh = hsz++;
+			while(hh > 0 && sort_run_less(&runs[r],heap[(hh-1)/2])) {
+				heap[hh] = heap[(hh-1)/2];
+				hh = (hh-1)/2;
+			}
+			heap[hh] = &runs[r];
+		}
+
+		while(hsz > 0 && !status) {
+			FPL_SORT_RUN *top = heap[0];
+
+			status = sort_emit_track(fplfile,outtie,(long)top->ofz);
+			if(status) break;
+
+			int rr = sort_run_next(top);
+			if(rr < 0) {
+				status = 1;
+				break;
+			} else if(rr == 0) {
+				top = heap[--hsz];
+			}
+			if(hsz == 0) break;
+
+			// sift down
+			int hh = 0;
+			for(;;) {
+				int cc = hh*2 + 1;
+				if(cc >= hsz) break;
+				if(cc + 1 < hsz && sort_run_less(heap[cc+1],heap[cc])) cc++;
+				if(!sort_run_less(heap[cc],top)) break;
+				heap[hh] = heap[cc];
+				hh = cc;
+			}
+			heap[hh] = top;
+		}
+
+		free(runs);
+		free(heap);
+	}
+
+	for(int r = 0; r < sort_run_count; r++) fclose(sort_runs[r]);
+	free(sort_runs);
+	free(sort_arena);
+	free(sort_idx);
+	sort_runs = NULL;
+	sort_run_count = 0;
+	sort_arena = NULL;
+	sort_idx = NULL;
+	sort_arena_sz = sort_arena_cap = sort_idx_count = sort_idx_cap = 0;
+
+	return status;
+}
+
+
+/*
+
+Row schemas
+
+The column-oriented formats (CSV, SQL, XML) are described by tables of columns:
+literal text before the value, where the value comes from, how it is escaped or
+how many decimals it gets, and literal text after it. The built-in tables are
+constexpr and are expanded at compile time by schema_row<> into one inlined
+emit_column() per column, so the switch below folds away and each format becomes
+straight-line code. A -sql_spec file is compiled at startup into a column array
+of the same shape and run by schema_emit().
+
+*/
+
+#define FPL_COL(prefix,source,name,escape,decimals,suffix) \
+	{ prefix, sizeof(prefix) - 1, source, name, escape, decimals, suffix, sizeof(suffix) - 1 }
+
+#ifdef _MSC_VER
+#define FPL_FORCEINLINE __forceinline
+#else
+#define FPL_FORCEINLINE inline __attribute__((always_inline))
+#endif
+
+static constexpr FPL_COLUMN csv_columns[] = {
+	FPL_COL("\"",      COL_FILENAME,     NULL,            ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_ATTRIB,       "title",         ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_ATTRIB,       "artist",        ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_ALBUM_ARTIST, "album artist",  ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_ATTRIB,       "album",         ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_TRACKNUM,     "tracknumber",   ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_ATTRIB,       "genre",         ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_ATTRIB,       "date",          ESCMODE_SQL,  0, "\""),
+	FPL_COL(",",       COL_DURATION,     NULL,            ESCMODE_NONE, 2, ""),		// duration (in seconds)
+	FPL_COL(",",       COL_INT,          "bitrate",       ESCMODE_NONE, 0, ""),
+	FPL_COL(",\"",     COL_ATTRIB,       "codec",         ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_ATTRIB,       "codec_profile", ESCMODE_SQL,  0, "\""),
+	FPL_COL(",",       COL_FSIZE,        NULL,            ESCMODE_NONE, 0, ""),
+	FPL_COL(",\"",     COL_DRIVE,        NULL,            ESCMODE_NONE, 0, "\"\n")	// option1
+};
+
+static constexpr FPL_COLUMN sql_columns[] = {
+	FPL_COL("INSERT INTO ", COL_SQL_TABLE, NULL,         ESCMODE_NONE, 0, " VALUES(0,"),	// key (auto-generated by mySQL)
+	FPL_COL("\"",      COL_FILENAME,     NULL,            ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_ATTRIB,       "title",         ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_ATTRIB,       "artist",        ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_ALBUM_ARTIST, "album artist",  ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_ATTRIB,       "album",         ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_TRACKNUM,     "tracknumber",   ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_ATTRIB,       "genre",         ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_ATTRIB,       "date",          ESCMODE_SQL,  0, "\""),
+	FPL_COL(",",       COL_DURATION,     NULL,            ESCMODE_NONE, 2, ""),
+	FPL_COL(",",       COL_INT,          "bitrate",       ESCMODE_NONE, 0, ""),
+	FPL_COL(",\"",     COL_ATTRIB,       "codec",         ESCMODE_SQL,  0, "\""),
+	FPL_COL(",\"",     COL_ATTRIB,       "codec_profile", ESCMODE_SQL,  0, "\""),
+	FPL_COL(",",       COL_FSIZE,        NULL,            ESCMODE_NONE, 0, ");\n\r")
+};
+
+// rhythmbox does not completely support album_artist tags
+// but has something similar called artist-sort
+static constexpr FPL_COLUMN xml_columns[] = {
+	FPL_COL("  <entry type=\"song\">\n    <title>", COL_ATTRIB, "title", ESCMODE_NONE, 0, "</title>\n"),
+	FPL_COL("    <genre>",        COL_ATTRIB,       "genre",        ESCMODE_NONE, 0, "</genre>\n"),
+	//FPL_COL("    <album-artist>", COL_ALBUM_ARTIST, "album artist", ESCMODE_NONE, 0, "</album-artist>\n"),
+	//FPL_COL("    <artist-sort>",  COL_ALBUM_ARTIST, "album artist", ESCMODE_NONE, 0, "</artist-sort>\n"),
+	FPL_COL("    <artist>",       COL_ATTRIB,       "artist",       ESCMODE_NONE, 0, "</artist>\n"),
+	FPL_COL("    <album>",        COL_ATTRIB,       "album",        ESCMODE_NONE, 0, "</album>\n"),
+	FPL_COL("    <track-number>", COL_NUMBER,       "tracknumber",  ESCMODE_NONE, 0, "</track-number>\n"),
+	FPL_COL("    <duration>",     COL_DURATION,     NULL,           ESCMODE_NONE, 0, "</duration>\n"),
+	FPL_COL("    <file-size>",    COL_FSIZE,        NULL,           ESCMODE_NONE, 0, "</file-size>\n"),
+	FPL_COL("    <location>",     COL_FILENAME,     NULL,           ESCMODE_XML,  0, "</location>\n"),
+	FPL_COL("    <mountpoint>file://", COL_MOUNTPOINT, NULL,        ESCMODE_NONE, 0, "</mountpoint>\n"
+	        "    <mtime>1269409449</mtime>\n"
+	        "    <last-seen>1291856711</last-seen>\n"),
+	FPL_COL("    <bitrate>",      COL_INT,          "bitrate",      ESCMODE_NONE, 0, "</bitrate>\n"),
+	FPL_COL("    <date>",         COL_JULIAN,       "date",         ESCMODE_NONE, 0, "</date>\n"
+	        "    <mimetype>application/x-id3</mimetype>\n"),
+	// additional fields (might not be used by rhythmbox)
+	//FPL_COL("\t\t<codec>",         COL_ATTRIB,       "codec",         ESCMODE_NONE, 0, "</codec>\n"),
+	//FPL_COL("\t\t<codec-profile>", COL_ATTRIB,       "codec_profile", ESCMODE_NONE, 0, "</codec-profile>\n"),
+	FPL_COL("  </entry>\n",       COL_LITERAL,      NULL,           ESCMODE_NONE, 0, "")
+};
+
+// raw or escaped value of an attribute
+static FPL_FORCEINLINE const char* col_attrib(const char *name, int listlen, int escape, char *scratch) {
+	if(escape == ESCMODE_NONE) return get_attrib((char*)name,listlen);
+	return esc_attrib((char*)name,listlen,escape,scratch,SCHEMA_SCRATCH);
+}
+
+// write one column of the current track
+static FPL_FORCEINLINE void emit_column(const FPL_COLUMN &col, char *trackfile, int listlen, char *scratch) {
+
+	double fval;
+	const char *sval;
+
+	ob_write(col.prefix,col.prefix_len);
+
+	switch(col.source) {
+		case COL_LITERAL:
+			break;
+		case COL_FILENAME:
+			if(col.escape == ESCMODE_NONE)      sval = trackfile;
+			else if(col.escape == ESCMODE_XML)  { xml_escape_str(trackfile,scratch,SCHEMA_SCRATCH); sval = scratch; }
+			else if(col.escape == ESCMODE_JSON) { json_escape_str(trackfile,scratch,SCHEMA_SCRATCH); sval = scratch; }
+			else                                { escape_str(trackfile,scratch,SCHEMA_SCRATCH); sval = scratch; }
+			ob_puts(sval);
+			break;
+		case COL_ATTRIB:
+			ob_puts(col_attrib(col.name,listlen,col.escape,scratch));
+			break;
+		case COL_ALBUM_ARTIST:
+			sval = col_attrib(col.name,listlen,col.escape,scratch);
+			if(strlen(sval) < 3) sval = col_attrib("artist",listlen,col.escape,scratch);
+			ob_puts(sval);
+			break;
+		case COL_TRACKNUM: {
+			const FPL_TYPED *tv = typed_attrib(col.name,listlen,TYPED_NUMBER);
+			if(tv->valid) ob_put_uint(tv->value);
+			else          ob_puts(col_attrib(col.name,listlen,col.escape,scratch));
+			break;
+		}
+		case COL_NUMBER:
+			ob_put_uint(typed_attrib(col.name,listlen,TYPED_NUMBER)->value);
+			break;
+		case COL_INT:
+			ob_put_uint(typed_attrib(col.name,listlen,TYPED_INT)->value);
+			break;
+		case COL_TIMESTAMP:
+			ob_put_fixed((double)typed_attrib(col.name,listlen,TYPED_DATE)->value,0);
+			break;
+		case COL_JULIAN: {
+			// rhythmbox stores dates as GDate julian days (0001-01-01 is day 1)
+			const FPL_TYPED *tv = typed_attrib(col.name,listlen,TYPED_DATE);
+			ob_put_fixed(tv->valid ? (double)(tv->days + 719163) : 0.0,0);
+			break;
+		}
+		case COL_DRIVE:
+			// if option_windrive is enabled, put the drive letter into option1
+			if(option_windrive && strlen(trackfile) > 7) {
+				char drive = toupper(trackfile[7]);
+				ob_write(&drive,1);
+			}
+			break;
+		case COL_MOUNTPOINT:
+			if(strlen(trackfile) > 8) ob_write(trackfile + 7,2);
+			break;
+		case COL_SQL_TABLE:
+			ob_puts(sql_table);
+			break;
+		default:
+			switch(col.source) {
+				case COL_DURATION:	memcpy((void*)&fval,chunkrunner.duration_dbl,8); break;
+				case COL_FSIZE:		fval = chunkrunner.fsize; break;
+				case COL_SUBSONG:	fval = chunkrunner.subsong; break;
+				case COL_RPG_ALBUM:	fval = chunkrunner.rpg_album; break;
+				case COL_RPG_TRACK:	fval = chunkrunner.rpg_track; break;
+				case COL_RPK_ALBUM:	fval = chunkrunner.rpk_album; break;
+				default:			fval = chunkrunner.rpk_track; break;
+			}
+			ob_put_fixed(fval,col.decimals);
+			break;
+	}
+
+	ob_write(col.suffix,col.suffix_len);
+}
+
+// compile-time expansion of a constexpr column table
+template<const FPL_COLUMN *cols, int I, int N>
+struct schema_row {
+	static FPL_FORCEINLINE void emit(char *trackfile, int listlen, char *scratch) {
+		emit_column(cols[I],trackfile,listlen,scratch);
+		schema_row<cols,I + 1,N>::emit(trackfile,listlen,scratch);
+	}
+};
+
+template<const FPL_COLUMN *cols, int N>
+struct schema_row<cols,N,N> {
+	static FPL_FORCEINLINE void emit(char *, int, char *) { }
+};
+
+#define SCHEMA_ROW(cols) schema_row<cols,0,(int)(sizeof(cols) / sizeof(cols[0]))>::emit
+
+// run a column array compiled at startup (-sql_spec)
+void schema_emit(const FPL_COLUMN *cols, int ncols, char *trackfile, int listlen) {
+
+	char scratch[SCHEMA_SCRATCH + 8];
+
+	for(int i = 0; i < ncols; i++) emit_column(cols[i],trackfile,listlen,scratch);
+}
+
+// read a -sql_spec file; the columns are compiled by spec_compile once the
+// output mode and table name are known
+int load_spec(char *spfile) {
+
+	FILE *spf;
+	char  sline[1024];
+	int   lineno = 0;
+
+	if((spf = fopen(spfile,"r")) == NULL) {
+		printf("error: unable to open spec file \"%s\"\n",spfile);
+		return 1;
+	}
+
+	while(fgets(sline,sizeof(sline),spf) != NULL) {
+		lineno++;
+
+		// strip line endings and trailing whitespace
+		int slen = strlen(sline);
+		while(slen > 0 && isspace((unsigned char)sline[slen - 1])) sline[--slen] = NULL;
+
+		char *sp = sline;
+		while(*sp == ' ' || *sp == '\t') sp++;
+		if(*sp == NULL || *sp == '#') continue;
+
+		// column name, then the field it is filled from
+		char *cname = sp;
+		while(*sp && *sp != ' ' && *sp != '\t') sp++;
+		if(*sp) *sp++ = NULL;
+		while(*sp == ' ' || *sp == '\t') sp++;
+
+		char *fname = sp;
+		int   flen = strlen(fname);
+		if(flen >= 2 && (fname[0] == '"' || fname[0] == '\'') && fname[flen - 1] == fname[0]) {
+			fname[flen - 1] = NULL;
+			fname++;
+		}
+
+		if(*fname == NULL || strlen(cname) >= sizeof(spec_entries[0].column) || strlen(fname) >= sizeof(spec_entries[0].field)) {
+			printf("error: spec file line %i: expected \"column_name field\"\n",lineno);
+			fclose(spf);
+			return 1;
+		}
+
+		FPL_SPEC_ENTRY *nentries = (FPL_SPEC_ENTRY*)realloc(spec_entries,sizeof(FPL_SPEC_ENTRY) * (spec_entry_count + 1));
+		if(nentries == NULL) {
+			printf("error allocating memory for spec file!\n");
+			fclose(spf);
+			return 1;
+		}
+		spec_entries = nentries;
+		strcpy(spec_entries[spec_entry_count].column,cname);
+		strcpy(spec_entries[spec_entry_count].field,fname);
+		spec_entry_count++;
+	}
+
+	fclose(spf);
+
+	if(spec_entry_count == 0) {
+		printf("error: spec file \"%s\" has no columns\n",spfile);
+		return 1;
+	}
+
+	return 0;
+}
+
+static char* spec_strdup(const char *str) {
+	char *dup = (char*)malloc(strlen(str) + 1);
+	if(dup != NULL) strcpy(dup,str);
+	return dup;
+}
+
+// compile the loaded spec entries into spec_cols for the current output mode
+int spec_compile() {
+
+	// WHERE_FIELD_* -> COL_*
+	static const int  field_cols[] = { COL_ATTRIB, COL_FILENAME, COL_DURATION, COL_FSIZE, COL_SUBSONG,
+	                                   COL_RPG_ALBUM, COL_RPG_TRACK, COL_RPK_ALBUM, COL_RPK_TRACK };
+	static const int  field_decimals[] = { 0, 0, 2, 0, 0, 2, 2, 6, 6 };
+
+	char   rowstart[2048];
+	size_t rlen;
+
+	if(outmode != OUTMODE_CSV && outmode != OUTMODE_SQL_FILE) {
+		printf("error: -sql_spec can only be used with -csv or -sql_file output!\n\n");
+		return 1;
+	}
+
+	// the CSV header line, or the SQL statement up to the first value
+	if(outmode == OUTMODE_CSV) rlen = 0;
+	else                       rlen = snprintf(rowstart,sizeof(rowstart),"INSERT INTO %s (",sql_table);
+
+	for(int i = 0; i < spec_entry_count && rlen < sizeof(rowstart); i++) {
+		rlen += snprintf(rowstart + rlen,sizeof(rowstart) - rlen,"%s%s",
+		                 i ? (outmode == OUTMODE_CSV ? ", " : ",") : "",spec_entries[i].column);
+	}
+	if(rlen < sizeof(rowstart)) {
+		rlen += snprintf(rowstart + rlen,sizeof(rowstart) - rlen,"%s",outmode == OUTMODE_CSV ? "\n" : ") VALUES(");
+	}
+	if(rlen >= sizeof(rowstart)) {
+		printf("error: spec file column list is too long!\n");
+		return 1;
+	}
+
+	if(outmode == OUTMODE_CSV) {
+		spec_header = spec_strdup(rowstart);
+		rowstart[0] = NULL;
+	}
+
+	if((spec_cols = (FPL_COLUMN*)calloc(spec_entry_count,sizeof(FPL_COLUMN))) == NULL) {
+		printf("error allocating memory for spec columns!\n");
+		return 1;
+	}
+
+	for(int i = 0; i < spec_entry_count; i++) {
+		FPL_COLUMN *col = &spec_cols[i];
+		char *fname = spec_entries[i].field;
+		int   field = lookup_field(fname);
+		int   source = field_cols[field];
+		char  prefix[2048];
+		const char *suffix;
+
+		// attribute:number, attribute:int, attribute:timestamp -> decoded value
+		char *tsep = strrchr(fname,':');
+		if(field == WHERE_FIELD_ATTRIB && tsep != NULL) {
+			if(!strcmp(tsep,":number"))         source = COL_NUMBER;
+			else if(!strcmp(tsep,":int"))       source = COL_INT;
+			else if(!strcmp(tsep,":timestamp")) source = COL_TIMESTAMP;
+			if(source != COL_ATTRIB) *tsep = NULL;
+		}
+
+		bool quoted = (source == COL_ATTRIB || source == COL_FILENAME);
+
+		snprintf(prefix,sizeof(prefix),"%s%s",i ? "," : rowstart,quoted ? "\"" : "");
+		if(i == spec_entry_count - 1) suffix = (outmode == OUTMODE_CSV) ? (quoted ? "\"\n" : "\n") : (quoted ? "\");\n" : ");\n");
+		else                          suffix = quoted ? "\"" : "";
+
+		spec_count++;
+		col->source   = source;
+		col->escape   = quoted ? ESCMODE_SQL : ESCMODE_NONE;
+		col->decimals = field_decimals[field];
+		col->prefix   = spec_strdup(prefix);
+		col->suffix   = spec_strdup(suffix);
+		col->name     = spec_strdup(fname);
+		if(col->prefix == NULL || col->suffix == NULL || col->name == NULL) {
+			printf("error allocating memory for spec columns!\n");
+			return 1;
+		}
+		col->prefix_len = strlen(col->prefix);
+		col->suffix_len = strlen(col->suffix);
+	}
+
+	return 0;
+}
+
+void spec_free() {
+	for(int i = 0; i < spec_count; i++) {
+		free((void*)spec_cols[i].prefix);
+		free((void*)spec_cols[i].suffix);
+		free((void*)spec_cols[i].name);
+	}
+	free(spec_cols);
+	free(spec_entries);
+	free(spec_header);
+	spec_cols = NULL;
+	spec_entries = NULL;
+	spec_header = NULL;
+	spec_count = spec_entry_count = 0;
+}
+
+
+int null_output(FILE *outfile, char *trackfile, int listlen) {
+
+	return 0;
+}
+
+int csv_output(FILE *outfile, char *trackfile, int listlen) {
+
+	static bool headerwrite = false;
+
+	char scratch[SCHEMA_SCRATCH + 8];
+
+	// write header
+	if(!headerwrite) {
+		ob_puts(spec_count ? spec_header : "filename, title, artist, album_artist, album, tracknum, genre, year, duration, bitrate, codec, codec_profile, filesize, option1\n");
+		headerwrite = true;
+	}
+
+	// write footer (if needed)
+	if(listlen == -1) {
+		return 150;
+	}
+
+	// output rows with unique album/artist only
+	if(opt_alb_only) {
+		char b_album[SCHEMA_SCRATCH + 8];
+		const char *t_album_artist = esc_attrib((char*)"album artist",listlen,ESCMODE_SQL,scratch,SCHEMA_SCRATCH);
+		const char *t_album        = esc_attrib((char*)"album",listlen,ESCMODE_SQL,b_album,SCHEMA_SCRATCH);
+		if(strlen(t_album_artist) < 3) {
+			t_album_artist = esc_attrib((char*)"artist",listlen,ESCMODE_SQL,scratch,SCHEMA_SCRATCH);
+		}
+
+		if(!strcmp(last_aa,t_album_artist) && !strcmp(last_alb,t_album)) return 200;
+		strncpy(last_aa,t_album_artist,sizeof(last_aa) - 1);
+		strncpy(last_alb,t_album,sizeof(last_alb) - 1);
+	}
+
+	// filename, title, artist, album_artist, album, tracknum, genre, year, duration, bitrate, codec, codec_profile, filesize, option1
+	if(spec_count) schema_emit(spec_cols,spec_count,trackfile,listlen);
+	else           SCHEMA_ROW(csv_columns)(trackfile,listlen,scratch);
+
+	return 0;
+}
+
+/*
+
+XML, Rhythmbox-compatible schema
+
+added 12.08.2010 - jacob
+
+*/
+
+int xml_output(FILE *outfile, char *trackfile, int listlen) {
+
+	static bool headerwrite = false;
+
+	char scratch[SCHEMA_SCRATCH + 8];
+
+	// write header
+	if(!headerwrite) {
+		ob_puts("<?xml version=\"1.0\" standalone=\"yes\"?>\n");
+		ob_puts("<rhythmdb version=\"1.7\">\n");
+		headerwrite = true;
+	}
+
+	// write footer
+	if(listlen == -1) {
+		ob_puts("</rhythmdb>\n");
+		return 150;
+	}
+
+	SCHEMA_ROW(xml_columns)(trackfile,listlen,scratch);
+
+	return 0;
+}
+
+
+int sqlfile_output(FILE *outfile, char *trackfile, int listlen) {
+
+	char scratch[SCHEMA_SCRATCH + 8];
+
+	// footer callback... we dont need this for SQL file output.. ignore it
+	if(listlen == -1) return 150;
+
+	// key, filename, title, artist, album artist, tracknum, genre, year, duration, bitrate, codec, codec_profile, filesize
+	if(spec_count) schema_emit(spec_cols,spec_count,trackfile,listlen);
+	else           SCHEMA_ROW(sql_columns)(trackfile,listlen,scratch);
+
+	return 0;
+}
+
+
+
+/*
+
+Direct database output (-sqlite)
+
+Tracks go straight into a database through a backend: a table of functions that
+open the database and create the schema, run transactions, insert one row, and
+build indexes once the bulk load is done. mysql_output (the OUTMODE_MYSQL slot)
+batches rows into transactions of db_batch rows and knows nothing about the
+database itself, so a MySQL backend only needs its own FPL_DB_BACKEND.
+
+*/
+
+#ifdef FPL_USE_SQLITE
+
+sqlite3		   *sqlite_db = NULL;
+sqlite3_stmt   *sqlite_ins = NULL;		// the one prepared INSERT
+
+static int sqlite_exec(const char *sql) {
+	char *err = NULL;
+	if(sqlite3_exec(sqlite_db,sql,NULL,NULL,&err) != SQLITE_OK) {
+		printf("sqlite: %s\n",err ? err : sqlite3_errmsg(sqlite_db));
+		sqlite3_free(err);
+		return 1;
+	}
+	return 0;
+}
+
+static void sqlite_close();
+
+// undo a failed sqlite_open: close the handle, and remove the file if it was new
+static int sqlite_open_failed(const char *target, bool created) {
+	sqlite_close();
+	if(created) remove(target);
+	return 1;
+}
+
+static int sqlite_open(const char *target) {
+
+	struct stat st;
+	bool        created = (stat(target,&st) != 0);
+
+	if(sqlite3_open(target,&sqlite_db) != SQLITE_OK) {
+		printf("sqlite: unable to open \"%s\": %s\n",target,sqlite3_errmsg(sqlite_db));
+		return sqlite_open_failed(target,created);
+	}
+
+	// bulk load: no fsync per commit, rollback journal kept in memory
+	if(sqlite_exec("PRAGMA synchronous=OFF; PRAGMA journal_mode=MEMORY;")) return sqlite_open_failed(target,created);
+
+	char *sql = sqlite3_mprintf("CREATE TABLE IF NOT EXISTS \"%w\" ("
+	                            "id INTEGER PRIMARY KEY, filename TEXT, subsong INTEGER, title TEXT, "
+	                            "artist TEXT, album_artist TEXT, album TEXT, tracknumber INTEGER, "
+	                            "discnumber INTEGER, genre TEXT, date TEXT, timestamp INTEGER, "
+	                            "duration REAL, bitrate INTEGER, samplerate INTEGER, codec TEXT, "
+	                            "codec_profile TEXT, filesize INTEGER)",sql_table);
+	int status = sqlite_exec(sql);
+	sqlite3_free(sql);
+	if(status) return sqlite_open_failed(target,created);
+
+	sql = sqlite3_mprintf("INSERT INTO \"%w\" (filename, subsong, title, artist, album_artist, album, "
+	                      "tracknumber, discnumber, genre, date, timestamp, duration, bitrate, samplerate, "
+	                      "codec, codec_profile, filesize) VALUES(?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?,?)",sql_table);
+	status = sqlite3_prepare_v2(sqlite_db,sql,-1,&sqlite_ins,NULL);
+	sqlite3_free(sql);
+	if(status != SQLITE_OK) {
+		printf("sqlite: %s\n",sqlite3_errmsg(sqlite_db));
+		return sqlite_open_failed(target,created);
+	}
+
+	return 0;
+}
+
+static int sqlite_begin() {
+	return sqlite_exec("BEGIN");
+}
+
+static int sqlite_commit() {
+	return sqlite_exec("COMMIT");
+}
+
+static void sqlite_bind_str(int col, const char *str) {
+	if(str) sqlite3_bind_text(sqlite_ins,col,str,-1,SQLITE_STATIC);
+	else    sqlite3_bind_null(sqlite_ins,col);
+}
+
+static void sqlite_bind_int(int col, bool present, long long val) {
+	if(present) sqlite3_bind_int64(sqlite_ins,col,val);
+	else        sqlite3_bind_null(sqlite_ins,col);
+}
+
+static int sqlite_insert(const FPL_DB_ROW *row) {
+
+	sqlite_bind_str(1,row->filename);
+	sqlite3_bind_int64(sqlite_ins,2,row->subsong);
+	sqlite_bind_str(3,row->title);
+	sqlite_bind_str(4,row->artist);
+	sqlite_bind_str(5,row->album_artist);
+	sqlite_bind_str(6,row->album);
+	sqlite_bind_int(7,row->has_tracknumber,row->tracknumber);
+	sqlite_bind_int(8,row->has_discnumber,row->discnumber);
+	sqlite_bind_str(9,row->genre);
+	sqlite_bind_str(10,row->date);
+	sqlite_bind_int(11,row->has_timestamp,row->timestamp);
+	sqlite3_bind_double(sqlite_ins,12,row->duration);
+	sqlite_bind_int(13,row->has_bitrate,row->bitrate);
+	sqlite_bind_int(14,row->has_samplerate,row->samplerate);
+	sqlite_bind_str(15,row->codec);
+	sqlite_bind_str(16,row->codec_profile);
+	sqlite3_bind_int64(sqlite_ins,17,row->fsize);
+
+	int status = sqlite3_step(sqlite_ins);
+	sqlite3_reset(sqlite_ins);
+
+	if(status != SQLITE_DONE) {
+		printf("sqlite: %s\n",sqlite3_errmsg(sqlite_db));
+		return 1;
+	}
+
+	return 0;
+}
+
+static int sqlite_create_indexes() {
+
+	static const char *columns[] = { "artist", "album_artist", "album", NULL };
+
+	for(int i = 0; columns[i]; i++) {
+		char *sql = sqlite3_mprintf("CREATE INDEX IF NOT EXISTS \"%w_%w\" ON \"%w\" (%s)",
+		                            sql_table,columns[i],sql_table,columns[i]);
+		int status = sqlite_exec(sql);
+		sqlite3_free(sql);
+		if(status) return 1;
+	}
+
+	return 0;
+}
+
+static void sqlite_close() {
+	sqlite3_finalize(sqlite_ins);
+	sqlite3_close(sqlite_db);
+	sqlite_ins = NULL;
+	sqlite_db = NULL;
+}
+
+FPL_DB_BACKEND sqlite_backend = {
+	"sqlite", sqlite_open, sqlite_begin, sqlite_insert, sqlite_commit, sqlite_create_indexes, sqlite_close
+};
+
+#endif // FPL_USE_SQLITE
+
+
+// raw attribute value, or NULL if the track doesn't have it
+static const char* db_attrib(const char *astring, int listlen) {
+	unsigned int ofz = get_attrib_ofz((char*)astring,listlen);
+	return (ofz == FPL_NO_OFZ || ofz >= data_sz) ? NULL : dataprime + ofz;
+}
+
+int mysql_output(FILE *outfile, char *trackfile, int listlen) {
+
+	FPL_DB_ROW row;
+	double durationdub;
+
+	if(db_backend == NULL || db_failed) return 0;
+
+	// footer: commit the last batch, then index
+	if(listlen == -1) {
+		if(db_pending && db_backend->commit()) db_failed = true;
+		db_pending = 0;
+		if(!db_failed && opt_dbindex) {
+			if(verbose) printf("%s: creating indexes...\n",db_backend->name);
+			if(db_backend->create_indexes()) db_failed = true;
+		}
+		return 150;
+	}
+
+	if(db_pending == 0 && db_backend->begin()) {
+		db_failed = true;
+		return 0;
+	}
+
+	memcpy((void*)&durationdub,chunkrunner.duration_dbl,8);
+
+	// typed_attrib's result only lives until the next lookup, so copy them
+	FPL_TYPED tn = *typed_attrib("tracknumber",listlen,TYPED_NUMBER);
+	FPL_TYPED dn = *typed_attrib("discnumber",listlen,TYPED_NUMBER);
+	FPL_TYPED dt = *typed_attrib("date",listlen,TYPED_DATE);
+	FPL_TYPED br = *typed_attrib("bitrate",listlen,TYPED_INT);
+	FPL_TYPED sr = *typed_attrib("samplerate",listlen,TYPED_INT);
+
+	row.filename        = trackfile;
+	row.subsong         = chunkrunner.subsong;
+	row.title           = db_attrib("title",listlen);
+	row.artist          = db_attrib("artist",listlen);
+	row.album_artist    = db_attrib("album artist",listlen);
+	row.album           = db_attrib("album",listlen);
+	row.genre           = db_attrib("genre",listlen);
+	row.date            = db_attrib("date",listlen);
+	row.codec           = db_attrib("codec",listlen);
+	row.codec_profile   = db_attrib("codec_profile",listlen);
+	row.duration        = durationdub;
+	row.fsize           = chunkrunner.fsize;
+	row.has_tracknumber = tn.valid;
+	row.tracknumber     = tn.value;
+	row.has_discnumber  = dn.valid || tn.disc;
+	row.discnumber      = dn.valid ? dn.value : tn.disc;
+	row.has_timestamp   = dt.valid;
+	row.timestamp       = dt.value;
+	row.has_bitrate     = br.valid;
+	row.bitrate         = br.value;
+	row.has_samplerate  = sr.valid;
+	row.samplerate      = sr.value;
+
+	// same album artist fallback as the text outputs
+	if(row.album_artist == NULL || strlen(row.album_artist) < 3) row.album_artist = row.artist;
+
+	if(db_backend->insert(&row)) {
+		db_failed = true;
+		return 0;
+	}
+	db_rows++;
+
+	if(++db_pending >= db_batch) {
+		if(db_backend->commit()) db_failed = true;
+		db_pending = 0;
+	}
+
+	return 0;
+}
+
+int m3u_output(FILE *outfile, char *trackfile, int listlen) {
+
+
+
+	return 0;
+}
+
+int m3u_noext_output(FILE *outfile, char *trackfile, int listlen) {
+
+
+
+	return 0;
+}
+
+
+/*
+
+FPL playlist writer
+
+Tracks are buffered until the footer callback, since the string table precedes the
+track records in the file. Strings are copied into a new, deduplicated string table
+and each record's key array is copied in bulk, then its string offsets are patched
+in place. In -split mode, one writer is kept per distinct value of split_field.
+
+*/
+
+// FNV-1a
+static unsigned int fplw_strhash(const char *str) {
+	unsigned int h = 2166136261U;
+	while(*str) {
+		h ^= (unsigned char)*str++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+FPL_WRITER* fplw_create() {
+
+	FPL_WRITER *fplw = (FPL_WRITER*)calloc(1,sizeof(FPL_WRITER));
+	if(fplw == NULL) return NULL;
+
+	fplw->split_ofz = FPL_NO_OFZ;
+
+	return fplw;
+}
+
+void fplw_free(FPL_WRITER *fplw) {
+	if(fplw == NULL) return;
+	free(fplw->strtab);
+	free(fplw->strhash);
+	free(fplw->ofzmap);
+	free(fplw->recs);
+	free(fplw);
+}
+
+// add str to the string table (if not already present); returns its offset
+static unsigned int fplw_intern(FPL_WRITER *fplw, const char *str) {
+
+	unsigned int h, len;
+
+	// keep load factor under 1/2
+	if((fplw->strhash_used + 1) * 2 > fplw->strhash_sz) {
+		unsigned int nsz = fplw->strhash_sz ? fplw->strhash_sz * 2 : 1024;
+		unsigned int *ntab = (unsigned int*)malloc(sizeof(unsigned int) * nsz);
+		if(ntab == NULL) return FPL_NO_OFZ;
+		for(unsigned int i = 0; i < nsz; i++) ntab[i] = FPL_NO_OFZ;
+		for(unsigned int i = 0; i < fplw->strhash_sz; i++) {
+			if(fplw->strhash[i] == FPL_NO_OFZ) continue;
+			h = fplw_strhash(fplw->strtab + fplw->strhash[i]) & (nsz - 1);
+			while(ntab[h] != FPL_NO_OFZ) h = (h + 1) & (nsz - 1);
+			ntab[h] = fplw->strhash[i];
+		}
+		free(fplw->strhash);
+		fplw->strhash = ntab;
+		fplw->strhash_sz = nsz;
+	}
+
+	h = fplw_strhash(str) & (fplw->strhash_sz - 1);
+	while(fplw->strhash[h] != FPL_NO_OFZ) {
+		if(!strcmp(fplw->strtab + fplw->strhash[h],str)) return fplw->strhash[h];
+		h = (h + 1) & (fplw->strhash_sz - 1);
+	}
+
+	// append
+	len = strlen(str) + 1;
+	if(fplw->strtab_sz + len > fplw->strtab_cap) {
+		unsigned int ncap = fplw->strtab_cap ? fplw->strtab_cap * 2 : 65536;
+		while(ncap < fplw->strtab_sz + len) ncap *= 2;
+		char *ntab = (char*)realloc(fplw->strtab,ncap);
+		if(ntab == NULL) return FPL_NO_OFZ;
+		fplw->strtab = ntab;
+		fplw->strtab_cap = ncap;
+	}
+
+	unsigned int nofz = fplw->strtab_sz;
+	memcpy(fplw->strtab + nofz,str,len);
+	fplw->strtab_sz += len;
+
+	fplw->strhash[h] = nofz;
+	fplw->strhash_used++;
+
+	return nofz;
+}
+
+// translate a source string table offset to an offset in this writer's table
+static unsigned int fplw_map_ofz(FPL_WRITER *fplw, unsigned int ofz) {
+
+	unsigned int h;
+
+	// out-of-range references read as empty strings everywhere else; keep them empty
+	if(ofz >= data_sz) return fplw_intern(fplw,nullstring);
+
+	if((fplw->ofzmap_used + 1) * 2 > fplw->ofzmap_sz) {
+		unsigned int nsz = fplw->ofzmap_sz ? fplw->ofzmap_sz * 2 : 1024;
+		FPL_OFZ_MAP *nmap = (FPL_OFZ_MAP*)malloc(sizeof(FPL_OFZ_MAP) * nsz);
+		if(nmap == NULL) return fplw_intern(fplw,dataprime + ofz);
+		for(unsigned int i = 0; i < nsz; i++) nmap[i].key = FPL_NO_OFZ;
+		for(unsigned int i = 0; i < fplw->ofzmap_sz; i++) {
+			if(fplw->ofzmap[i].key == FPL_NO_OFZ) continue;
+			h = esc_hash(fplw->ofzmap[i].key,0) & (nsz - 1);
+			while(nmap[h].key != FPL_NO_OFZ) h = (h + 1) & (nsz - 1);
+			nmap[h] = fplw->ofzmap[i];
+		}
+		free(fplw->ofzmap);
+		fplw->ofzmap = nmap;
+		fplw->ofzmap_sz = nsz;
+	}
+
+	h = esc_hash(ofz,0) & (fplw->ofzmap_sz - 1);
+	while(fplw->ofzmap[h].key != FPL_NO_OFZ) {
+		if(fplw->ofzmap[h].key == ofz) return fplw->ofzmap[h].val;
+		h = (h + 1) & (fplw->ofzmap_sz - 1);
+	}
+
+	unsigned int nofz = fplw_intern(fplw,dataprime + ofz);
+	if(nofz == FPL_NO_OFZ) return FPL_NO_OFZ;
+
+	fplw->ofzmap[h].key = ofz;
+	fplw->ofzmap[h].val = nofz;
+	fplw->ofzmap_used++;
+
+	return fplw->ofzmap[h].val;
+}
+
+// append the current track (chunkrunner + keyrunner) to the writer; on failure the
+// track is dropped and fplw_failed is set
+int fplw_add_track(FPL_WRITER *fplw, char *trackfile) {
+
+	size_t recsz = sizeof(FPL_TRACK_CHUNK) + sizeof(unsigned int) * real_keys;
+
+	if(fplw->recs_sz + recsz > fplw->recs_cap) {
+		size_t ncap = fplw->recs_cap ? fplw->recs_cap * 2 : (1024*1024);
+		while(ncap < fplw->recs_sz + recsz) ncap *= 2;
+		char *nrecs = (char*)realloc(fplw->recs,ncap);
+		if(nrecs == NULL) {
+			printf("error allocating memory for FPL output records!\n");
+			fplw_failed = true;
+			return 1;
+		}
+		fplw->recs = nrecs;
+		fplw->recs_cap = ncap;
+	}
+
+	FPL_TRACK_CHUNK *chunk = (FPL_TRACK_CHUNK*)(fplw->recs + fplw->recs_sz);
+	unsigned int    *keys  = (unsigned int*)(fplw->recs + fplw->recs_sz + sizeof(FPL_TRACK_CHUNK));
+
+	// copy the record as-is, then patch string offsets
+	memcpy(chunk,&chunkrunner,sizeof(FPL_TRACK_CHUNK));
+	memcpy(keys,keyrunner,sizeof(unsigned int) * real_keys);
+
+	// remapped filenames are new strings; otherwise the original entry is reused
+	chunk->file_ofz = opt_remap ? fplw_intern(fplw,trackfile) : fplw_map_ofz(fplw,chunkrunner.file_ofz);
+	bool failed = (chunk->file_ofz == FPL_NO_OFZ);
+
+	// key array layout: key_primary (key,field name) pairs, value count, value offsets,
+	// then key_second (field name,value) pairs starting at key_sec_offset. Only the
+	// field names, primary values and secondary pairs are string offsets
+	int pvals = chunkrunner.key_primary * 2;
+	int pend  = pvals + 1;
+	int sbeg  = chunkrunner.key_sec_offset;
+	int send  = sbeg + chunkrunner.key_second * 2;
+
+	if(pvals < real_keys && keys[pvals] < (unsigned int)real_keys) pend += keys[pvals];
+	if(pend > sbeg) pend = sbeg;
+	if(pend > real_keys) pend = real_keys;
+	if(send > real_keys) send = real_keys;
+
+	for(int ii = 1; ii < pvals && ii < real_keys; ii += 2) {
+		failed |= ((keys[ii] = fplw_map_ofz(fplw,keys[ii])) == FPL_NO_OFZ);
+	}
+	for(int ii = pvals + 1; ii < pend; ii++) {
+		failed |= ((keys[ii] = fplw_map_ofz(fplw,keys[ii])) == FPL_NO_OFZ);
+	}
+	for(int ii = sbeg; ii < send; ii++) {
+		failed |= ((keys[ii] = fplw_map_ofz(fplw,keys[ii])) == FPL_NO_OFZ);
+	}
+
+	if(failed) {
+		printf("error allocating memory for FPL output strings!\n");
+		fplw_failed = true;
+		return 1;
+	}
+
+	fplw->recs_sz += recsz;
+	fplw->track_count++;
+
+	return 0;
+}
+
+// write the complete playlist to outfile (NULL = through the output buffer)
+int fplw_write(FPL_WRITER *fplw, FILE *outfile) {
+
+	unsigned char magicsig[16] = FPL_MAGIC_SIG;
+
+	if(outfile == NULL) {
+		ob_write((char*)magicsig,16);
+		ob_write((char*)&fplw->strtab_sz,4);
+		ob_write(fplw->strtab,fplw->strtab_sz);
+		ob_write((char*)&fplw->track_count,4);
+		ob_write(fplw->recs,fplw->recs_sz);
+		return 0;
+	}
+
+	fwrite(magicsig,16,1,outfile);
+	fwrite(&fplw->strtab_sz,4,1,outfile);
+	if(fplw->strtab_sz) fwrite(fplw->strtab,fplw->strtab_sz,1,outfile);
+	fwrite(&fplw->track_count,4,1,outfile);
+	if(fplw->recs_sz) fwrite(fplw->recs,fplw->recs_sz,1,outfile);
+
+	return ferror(outfile) ? 1 : 0;
+}
+
+// build the filename of a -split playlist: "base - value.ext"
+static void fplw_split_name(char *outname, int outsz, const char *value) {
+
+	char vbuf[256];
+	int  vl = 0;
+
+	for(int i = 0; value[i] && vl < (int)sizeof(vbuf) - 1; i++) {
+		switch(value[i]) {
+			case '/': case '\\': case ':': case '*': case '?':
+			case '\"': case '<': case '>': case '|':
+				vbuf[vl++] = '_';
+				break;
+			default:
+				vbuf[vl++] = value[i];
+				break;
+		}
+	}
+	vbuf[vl] = '\0';
+	if(vl == 0) strcpy(vbuf,"unknown");
+
+	const char *ext = strrchr(split_base,'.');
+	const char *dsep = strrchr(split_base,'/');
+	if(ext == NULL || (dsep && ext < dsep)) ext = split_base + strlen(split_base);
+
+	snprintf(outname,outsz,"%.*s - %s%s",(int)(ext - split_base),split_base,vbuf,ext);
+}
+
+int fpl_output(FILE *outfile, char *trackfile, int listlen) {
+
+	static FPL_WRITER  *fplw = NULL;		// single playlist output
+	static FPL_WRITER **splits = NULL;		// -split outputs
+	static int          split_count = 0;
+
+	// footer: write everything out (unless a track was lost)
+	if(listlen == -1) {
+		int status = 0;
+
+		if(fplw) {
+			if(!fplw_failed) status |= fplw_write(fplw,NULL);
+			if(verbose) printf("fpl_output: wrote %i tracks, %i bytes of string data\n",fplw->track_count,fplw->strtab_sz);
+			fplw_free(fplw);
+			fplw = NULL;
+		}
+
+		for(int i = 0; i < split_count; i++) {
+			FILE *sfile;
+			if(fplw_failed) {
+				// a track was lost: write nothing
+			} else if((sfile = fopen(splits[i]->filename,"wb")) == NULL) {
+				printf("Unable to open file \"%s\" for writing!\n",splits[i]->filename);
+				status = 1;
+			} else {
+				if(verbose) printf("fpl_output: writing %i tracks to \"%s\"\n",splits[i]->track_count,splits[i]->filename);
+				status |= fplw_write(splits[i],sfile);
+				fclose(sfile);
+			}
+			fplw_free(splits[i]);
+		}
+		free(splits);
+		splits = NULL;
+		split_count = 0;
+
+		return status ? 1 : 150;
+	}
+
+	if(fplw_failed) return 1;
+
+	if(!opt_split) {
+		if(outfile == NULL) return 0;
+		if(fplw == NULL && (fplw = fplw_create()) == NULL) return 1;
+		return fplw_add_track(fplw,trackfile);
+	}
+
+	// split mode: find the writer for this track's value
+	unsigned int vofz = get_attrib_ofz(split_field,listlen);
+	const char  *value = (vofz == FPL_NO_OFZ) ? nullstring : (dataprime + vofz);
+	FPL_WRITER  *target = NULL;
+	char         sname[1024];
+
+	for(int i = 0; i < split_count; i++) {
+		if(splits[i]->split_ofz == vofz) {
+			target = splits[i];
+			break;
+		}
+	}
+
+	if(target == NULL) {
+		// same value stored at a different offset maps to the same file
+		fplw_split_name(sname,sizeof(sname),value);
+		for(int i = 0; i < split_count; i++) {
+			if(!fpl_strcmpi(splits[i]->filename,sname)) {
+				target = splits[i];
+				break;
+			}
+		}
+	}
+
+	if(target == NULL) {
+		FPL_WRITER **nsplits = (FPL_WRITER**)realloc(splits,sizeof(FPL_WRITER*) * (split_count + 1));
+		if(nsplits == NULL || (target = fplw_create()) == NULL) {
+			printf("error allocating memory for FPL split output!\n");
+			return 1;
+		}
+		splits = nsplits;
+		splits[split_count++] = target;
+		target->split_ofz = vofz;
+		strcpy(target->filename,sname);
+	}
+
+	return fplw_add_track(target,trackfile);
+}
+
+
+/*
+
+JSON output (newline-delimited, or a single array with -json-array)
+
+Each track becomes one object holding the typed numeric fields from the track
+chunk and every primary and secondary attribute. Attribute names and values are
+escaped through the escape cache; everything goes through the output buffer.
+
+*/
+
+// write a string table entry as a quoted JSON string
+static void json_put_ofz(unsigned int ofz) {
+
+	const char *esc = escape_cached(ofz,ESCMODE_JSON,NULL,0);
+
+	if(esc == NULL) {
+		// not cached (long value): escape directly into the output buffer
+		ob_put_json_str(dataprime + ofz);
+		return;
+	}
+
+	ob_write("\"",1);
+	ob_puts(esc);
+	ob_write("\"",1);
+}
+
+// JSON number: like ob_put_fixed, but non-finite values (which JSON can't hold) become null
+static void json_put_fixed(double val, int decimals) {
+	if(!std::isfinite(val)) ob_write("null",4);
+	else                    ob_put_fixed(val,decimals);
+}
+
+// write "key":value, preceded by a comma after the first member
+static void json_put_member(bool *first, const char *key, long long val) {
+	if(!*first) ob_write(",",1);
+	*first = false;
+	ob_write("\"",1);
+	ob_puts(key);
+	ob_write("\":",2);
+	ob_put_fixed((double)val,0);
+}
+
+// decoded track/disc numbers, date and integer attributes (only those present)
+static void json_put_typed(int listlen) {
+
+	// copied: typed_attrib's result only lives until the next lookup
+	FPL_TYPED tn = *typed_attrib("tracknumber",listlen,TYPED_NUMBER);
+	FPL_TYPED dn = *typed_attrib("discnumber",listlen,TYPED_NUMBER);
+	FPL_TYPED dt = *typed_attrib("date",listlen,TYPED_DATE);
+	FPL_TYPED br = *typed_attrib("bitrate",listlen,TYPED_INT);
+	FPL_TYPED sr = *typed_attrib("samplerate",listlen,TYPED_INT);
+	bool      first = true;
+
+	ob_write(",\"typed\":{",10);
+	if(tn.valid) {
+		json_put_member(&first,"tracknumber",tn.value);
+		if(tn.total) json_put_member(&first,"totaltracks",tn.total);
+	}
+	if(dn.valid) {
+		json_put_member(&first,"discnumber",dn.value);
+		if(dn.total) json_put_member(&first,"totaldiscs",dn.total);
+	} else if(tn.valid && tn.disc) {
+		json_put_member(&first,"discnumber",tn.disc);
+	}
+	if(dt.valid) json_put_member(&first,"date",dt.value);
+	if(br.valid) json_put_member(&first,"bitrate",br.value);
+	if(sr.valid) json_put_member(&first,"samplerate",sr.value);
+	ob_write("}",1);
+}
+
+int json_output(FILE *outfile, char *trackfile, int listlen) {
+
+	static unsigned int trackcount = 0;
+
+	double durationdub;
+
+	if(outfile == NULL) return 0;
+
+	// write footer
+	if(listlen == -1) {
+		if(opt_json_array) ob_puts(trackcount ? "\n]\n" : "[]\n");
+		return 150;
+	}
+
+	if(opt_json_array) ob_write(trackcount ? ",\n" : "[\n",2);
+	trackcount++;
+
+	memcpy((void*)&durationdub,chunkrunner.duration_dbl,8);
+
+	ob_write("{\"filename\":",12);
+	ob_put_json_str(trackfile);
+	ob_write(",\"subsong\":",11);
+	ob_put_uint(chunkrunner.subsong);
+	ob_write(",\"fsize\":",9);
+	ob_put_uint(chunkrunner.fsize);
+	ob_write(",\"duration\":",12);
+	json_put_fixed(durationdub,3);
+	ob_write(",\"rg_album\":",12);
+	json_put_fixed(chunkrunner.rpg_album,2);
+	ob_write(",\"rg_track\":",12);
+	json_put_fixed(chunkrunner.rpg_track,2);
+	ob_write(",\"rpk_album\":",13);
+	json_put_fixed(chunkrunner.rpk_album,6);
+	ob_write(",\"rpk_track\":",13);
+	json_put_fixed(chunkrunner.rpk_track,6);
+	json_put_typed(listlen);
+
+	// primary attributes come first in trackrunner, secondary ones have key == -1
+	ob_write(",\"primary\":{",12);
+	int ii = 0;
+	for(; ii < listlen && trackrunner[ii].key != -1; ii++) {
+		if(ii) ob_write(",",1);
+		json_put_ofz(trackrunner[ii].field_name - dataprime);
+		ob_write(":",1);
+		json_put_ofz(trackrunner[ii].value_ofz);
+	}
+
+	ob_write("},\"secondary\":{",15);
+	for(int first = ii; ii < listlen; ii++) {
+		if(ii > first) ob_write(",",1);
+		json_put_ofz(trackrunner[ii].field_name - dataprime);
+		ob_write(":",1);
+		json_put_ofz(trackrunner[ii].value_ofz);
+	}
+
+	ob_write(opt_json_array ? "}}" : "}}\n",opt_json_array ? 2 : 3);
+
+	return 0;
+}
+
+
+/*
+
+Long-format (EAV) output
+
+One "track_id,field_id,value_id" row per attribute of every track. Field names
+and values are interned by string table offset: the first time an offset is seen
+it gets the next id and one line in the matching dictionary file, written next to
+output_file:
+
+	output_file.fields.csv	field_id,"name",secondary
+	output_file.values.csv	value_id,"value"
+	output_file.tracks.csv	track_id,"filename",subsong,filesize,duration
+
+*/
+
+// id of a string table offset in an intern map (FPL_NO_OFZ on allocation failure);
+// *isnew is set when the offset got a new id
+static unsigned int eav_intern(FPL_OFZ_MAP **map, unsigned int *mapsz, unsigned int *used, unsigned int ofz, bool *isnew) {
+
+	unsigned int h;
+
+	*isnew = false;
+
+	if((*used + 1) * 2 > *mapsz) {
+		unsigned int nsz = *mapsz ? *mapsz * 2 : 1024;
+		FPL_OFZ_MAP *nmap = (FPL_OFZ_MAP*)malloc(sizeof(FPL_OFZ_MAP) * nsz);
+		if(nmap == NULL) return FPL_NO_OFZ;
+		for(unsigned int i = 0; i < nsz; i++) nmap[i].key = FPL_NO_OFZ;
+		for(unsigned int i = 0; i < *mapsz; i++) {
+			if((*map)[i].key == FPL_NO_OFZ) continue;
+			h = esc_hash((*map)[i].key,0) & (nsz - 1);
+			while(nmap[h].key != FPL_NO_OFZ) h = (h + 1) & (nsz - 1);
+			nmap[h] = (*map)[i];
+		}
+		free(*map);
+		*map = nmap;
+		*mapsz = nsz;
+	}
+
+	h = esc_hash(ofz,0) & (*mapsz - 1);
+	while((*map)[h].key != FPL_NO_OFZ) {
+		if((*map)[h].key == ofz) return (*map)[h].val;
+		h = (h + 1) & (*mapsz - 1);
+	}
+
+	(*map)[h].key = ofz;
+	(*map)[h].val = (*used)++;
+	*isnew = true;
+
+	return (*map)[h].val;
+}
+
+// open the dictionary files that go with output_file
+int eav_open(char *outname) {
+
+	static const char *suffix[] = { ".fields.csv", ".values.csv", ".tracks.csv" };
+	static const char *header[] = { "field_id,name,secondary\n", "value_id,value\n",
+	                                "track_id,filename,subsong,filesize,duration\n" };
+	FILE **files[] = { &eav_fieldfile, &eav_valuefile, &eav_trackfile };
+	char   fname[1100];
+
+	for(int i = 0; i < 3; i++) {
+		snprintf(fname,sizeof(fname),"%s%s",outname,suffix[i]);
+		if(verbose) printf("eav: writing dictionary \"%s\"\n",fname);
+		if((*files[i] = fopen(fname,"w")) == NULL) {
+			printf("Unable to open \"%s\" for writing!\n\n",fname);
+			return 1;
+		}
+		fputs(header[i],*files[i]);
+	}
+
+	return 0;
+}
+
+// close the dictionary files; returns non-zero if any write failed
+int eav_close() {
+
+	FILE **files[] = { &eav_fieldfile, &eav_valuefile, &eav_trackfile };
+	int    status = eav_failed ? 1 : 0;
+
+	for(int i = 0; i < 3; i++) {
+		if(*files[i] == NULL) continue;
+		if(ferror(*files[i]) || fclose(*files[i])) status = 1;
+		*files[i] = NULL;
+	}
+
+	if(verbose) printf("eav: %u tracks, %u fields, %u values\n",eav_track_id,eav_field_used,eav_value_used);
+
+	free(eav_fields);
+	free(eav_values);
+	free(eav_escbuf);
+	eav_fields = eav_values = NULL;
+	eav_escbuf = NULL;
+	eav_field_sz = eav_field_used = eav_value_sz = eav_value_used = 0;
+	eav_escbuf_sz = 0;
+
+	return status;
+}
+
+// SQL-escape str in full into eav_escbuf (escape_str at most doubles its input);
+// NULL if out of memory
+static const char* eav_escape(const char *str) {
+
+	size_t need = strlen(str) * 2 + 8;
+
+	if(need > eav_escbuf_sz) {
+		char *nbuf = (char*)realloc(eav_escbuf,need);
+		if(nbuf == NULL) return NULL;
+		eav_escbuf = nbuf;
+		eav_escbuf_sz = need;
+	}
+
+	escape_str((char*)str,eav_escbuf,(int)eav_escbuf_sz - 4);
+
+	return eav_escbuf;
+}
+
+// escaped string table entry: from the escape cache, or in full through eav_escape
+static const char* eav_escape_ofz(unsigned int ofz) {
+	const char *esc = escape_cached(ofz,ESCMODE_SQL,NULL,0);
+	return esc ? esc : eav_escape(dataprime + ofz);
+}
+
+int eav_output(FILE *outfile, char *trackfile, int listlen) {
+
+	static bool headerwrite = false;
+
+	const char *esc;
+	double      durationdub;
+	bool        isnew;
+
+	if(!headerwrite) {
+		ob_puts("track_id,field_id,value_id\n");
+		headerwrite = true;
+	}
+
+	if(listlen == -1 || eav_failed) return 150;
+
+	memcpy((void*)&durationdub,chunkrunner.duration_dbl,8);
+	if((esc = eav_escape(trackfile)) == NULL) {
+		printf("error allocating memory for EAV output!\n");
+		eav_failed = true;
+		return 0;
+	}
+	fprintf(eav_trackfile,"%u,\"%s\",%u,%u,%0.03f\n",eav_track_id,esc,chunkrunner.subsong,chunkrunner.fsize,durationdub);
+
+	for(int ii = 0; ii < listlen; ii++) {
+		unsigned int name_ofz = trackrunner[ii].field_name - dataprime;
+		unsigned int value_ofz = trackrunner[ii].value_ofz;
+
+		unsigned int field_id = eav_intern(&eav_fields,&eav_field_sz,&eav_field_used,name_ofz,&isnew);
+		if(field_id == FPL_NO_OFZ) {
+			printf("error allocating memory for EAV dictionaries!\n");
+			eav_failed = true;
+			return 0;
+		}
+		if(isnew) {
+			if((esc = eav_escape_ofz(name_ofz)) == NULL) {
+				printf("error allocating memory for EAV output!\n");
+				eav_failed = true;
+				return 0;
+			}
+			fprintf(eav_fieldfile,"%u,\"%s\",%i\n",field_id,esc,trackrunner[ii].key == -1 ? 1 : 0);
+		}
+
+		unsigned int value_id = eav_intern(&eav_values,&eav_value_sz,&eav_value_used,value_ofz,&isnew);
+		if(value_id == FPL_NO_OFZ) {
+			printf("error allocating memory for EAV dictionaries!\n");
+			eav_failed = true;
+			return 0;
+		}
+		if(isnew) {
+			if((esc = eav_escape_ofz(value_ofz)) == NULL) {
+				printf("error allocating memory for EAV output!\n");
+				eav_failed = true;
+				return 0;
+			}
+			fprintf(eav_valuefile,"%u,\"%s\"\n",value_id,esc);
+		}
+
+		ob_put_uint(eav_track_id);
+		ob_write(",",1);
+		ob_put_uint(field_id);
+		ob_write(",",1);
+		ob_put_uint(value_id);
+		ob_write("\n",1);
+	}
+
+	eav_track_id++;
+
+	return 0;
+}
+
+
+/*
+
+File verification (-verify)
+
+Collects the local path and recorded size of every track, then stats them all at
+the end: the list is sorted by path so that files in the same directory are
+checked together (and repeated paths, such as cue sheet subsongs, only once), and
+handed out in chunks to a pool of threads. Only missing files and size mismatches
+are reported, in path order.
+
+*/
+
+// file:// filename -> local path; false for anything that isn't a plain file
+static bool verify_local_path(const char *trackfile, char *path, int pathsz) {
+
+	if(strncmp(trackfile,"file://",7)) return false;
+
+	// "file://C:\..." -> "C:\...", "file:///mnt/..." -> "/mnt/..."
+	strncpy(path,trackfile + 7,pathsz - 1);
+	path[pathsz - 1] = NULL;
+
+#ifndef _WIN32
+	for(char *p = path; *p; p++) {
+		if(*p == '\\') *p = '/';
+	}
+#endif
+
+	return path[0] != NULL;
+}
+
+static void verify_worker(std::atomic<size_t> *next) {
+
+	size_t count = verify_list.size();
+	struct stat st;
+
+	for(;;) {
+		size_t lo = next->fetch_add(VERIFY_CHUNK);
+		if(lo >= count) break;
+		size_t hi = std::min(lo + VERIFY_CHUNK,count);
+
+		for(size_t i = lo; i < hi; i++) {
+			FPL_VERIFY_ENTRY *ve = &verify_list[i];
+			const char       *path = &verify_strs[ve->path];
+
+			if(i > lo && !strcmp(path,&verify_strs[verify_list[i-1].path])) {
+				ve->actual = verify_list[i-1].actual;
+				continue;
+			}
+
+			if(stat(path,&st) == 0 && (st.st_mode & S_IFMT) != S_IFDIR) ve->actual = (long long)st.st_size;
+			else                                                        ve->actual = -1;
+		}
+	}
+}
+
+static bool verify_path_less(const FPL_VERIFY_ENTRY &a, const FPL_VERIFY_ENTRY &b) {
+	return strcmp(&verify_strs[a.path],&verify_strs[b.path]) < 0;
+}
+
+// stat everything collected so far and report the problems
+static int verify_run(FILE *outfile) {
+
+	std::atomic<size_t>      next(0);
+	std::vector<std::thread> workers;
+	unsigned int missing = 0, mismatched = 0;
+	char         escname[1024 + 8];
+
+	std::sort(verify_list.begin(),verify_list.end(),verify_path_less);
+
+	int nthreads = verify_threads;
+	if((size_t)nthreads > verify_list.size() / VERIFY_CHUNK + 1) nthreads = (int)(verify_list.size() / VERIFY_CHUNK + 1);
+	if(verbose) printf("verify: checking %u files on %i threads...\n",(unsigned int)verify_list.size(),nthreads);
+
+	try {
+		for(int t = 1; t < nthreads; t++) workers.push_back(std::thread(verify_worker,&next));
+	} catch(...) {
+		// fewer threads, same result
+	}
+	verify_worker(&next);
+	for(size_t t = 0; t < workers.size(); t++) workers[t].join();
+
+	if(outfile) ob_puts("status,expected_size,actual_size,filename\n");
+
+	for(size_t i = 0; i < verify_list.size(); i++) {
+		FPL_VERIFY_ENTRY *ve = &verify_list[i];
+		const char       *name = &verify_strs[ve->name];
+
+		// the playlist only keeps the low 32 bits of the size
+		if(ve->actual >= 0 && (unsigned int)ve->actual == ve->fsize) continue;
+
+		if(ve->actual < 0) missing++;
+		else               mismatched++;
+
+		if(outfile == NULL) {
+			if(ve->actual < 0) printf("missing: %s\n",name);
+			else               printf("size mismatch (%u, found %lld): %s\n",ve->fsize,ve->actual,name);
+			continue;
+		}
+
+		escape_str((char*)name,escname,1024);
+		ob_puts(ve->actual < 0 ? "\"missing\"," : "\"size\",");
+		ob_put_uint(ve->fsize);
+		ob_write(",",1);
+		if(ve->actual >= 0) ob_put_uint(ve->actual);
+		ob_write(",\"",2);
+		ob_puts(escname);
+		ob_write("\"\n",2);
+	}
+
+	printf("verify: %u files checked, %u missing, %u size mismatches, %u skipped (not file://)\n",
+	       (unsigned int)verify_list.size(),missing,mismatched,verify_skipped);
+
+	return 0;
+}
+
+int verify_output(FILE *outfile, char *trackfile, int listlen) {
+
+	char path[1024];
+
+	if(listlen == -1) {
+		verify_run(outfile);
+		verify_list.clear();
+		verify_strs.clear();
+		return 150;
+	}
+
+	if(!verify_local_path(trackfile,path,sizeof(path))) {
+		verify_skipped++;
+		return 0;
+	}
+
+	FPL_VERIFY_ENTRY ve;
+	ve.fsize  = chunkrunner.fsize;
+	ve.actual = -1;
+	ve.path   = verify_strs.size();
+	verify_strs.insert(verify_strs.end(),path,path + strlen(path) + 1);
+	ve.name   = verify_strs.size();
+	verify_strs.insert(verify_strs.end(),trackfile,trackfile + strlen(trackfile) + 1);
+	verify_list.push_back(ve);
+
+	return 0;
+}
+
+
+/*
+
+Duplicate detection (-dupes)
+
+Each track gets a 64-bit hash of its normalized artist and title (case-folded,
+with whitespace, punctuation and any (...) or [...] part of the title dropped, so
+"Help! (Remastered)" matches "help"). At the end the tracks are sorted by name
+and duration, and each name's durations are split into groups: a group starts
+at its shortest track and takes every following track up to dupe_tolerance
+seconds longer, so no group spans more than the tolerance (100, 101.5, 103 and
+104.5s with a 2s tolerance are two groups, not one chain). Groups with more
+than one track are listed in playlist order.
+
+*/
+
+// FNV-1a over the normalized form of str; *kept counts the characters hashed
+static unsigned long long dupe_hash(const char *str, unsigned long long h, bool strip_parens, int *kept) {
+
+	int depth = 0;
+
+	for(const unsigned char *p = (const unsigned char*)str; *p; p++) {
+		unsigned char c = *p;
+
+		if(strip_parens && (c == '(' || c == '[')) { depth++; continue; }
+		if(strip_parens && (c == ')' || c == ']')) { if(depth) depth--; continue; }
+		if(depth) continue;
+
+		// keep letters, digits and anything non-ASCII (UTF-8 sequences);
+		// upper case Latin-1 letters (U+00C0-U+00DE) are folded as well
+		if(c < 0x80) {
+			if(!isalnum(c)) continue;
+			c = (unsigned char)tolower(c);
+		} else if(c == 0xC3 && p[1] >= 0x80 && p[1] <= 0x9E && p[1] != 0x97) {
+			h = (h ^ c) * 1099511628211ULL;
+			c = p[1] + 0x20;
+			p++;
+		}
+
+		h = (h ^ c) * 1099511628211ULL;
+		(*kept)++;
+	}
+
+	return h;
+}
+
+// list the groups; rows of a group are in playlist order
+static void dupe_report(FILE *outfile) {
+
+	std::vector<int> order(dupe_list.size());
+	char         escname[1024 + 8];
+	char         esccodec[64 + 8];
+	unsigned int groups = 0;
+
+	for(size_t i = 0; i < order.size(); i++) order[i] = (int)i;
+
+	// by name, then duration (ties in playlist order)
+	std::stable_sort(order.begin(),order.end(),[](int a, int b) {
+		if(dupe_list[a].name != dupe_list[b].name) return dupe_list[a].name < dupe_list[b].name;
+		return dupe_list[a].duration < dupe_list[b].duration;
+	});
+
+	// split each name's run where a track is more than the tolerance longer
+	// than the group's shortest track; the group is its earliest playlist entry
+	for(size_t k = 0; k < order.size(); ) {
+		size_t end = k + 1;
+		while(end < order.size() && dupe_list[order[end]].name == dupe_list[order[k]].name &&
+			  dupe_list[order[end]].duration - dupe_list[order[k]].duration <= dupe_tolerance) end++;
+		if(end - k > 1) {
+			int first = order[k];
+			for(size_t j = k; j < end; j++) first = std::min(first,order[j]);
+			for(size_t j = k; j < end; j++) dupe_list[order[j]].group = first;
+		}
+		k = end;
+	}
+
+	// group by its first track, then by playlist position
+	order.clear();
+	for(size_t i = 0; i < dupe_list.size(); i++) {
+		if(dupe_list[i].group != -1) order.push_back((int)i);
+	}
+	std::stable_sort(order.begin(),order.end(),[](int a, int b) { return dupe_list[a].group < dupe_list[b].group; });
+
+	if(outfile) ob_puts("group,filename,codec,bitrate,filesize,duration\n");
+
+	for(size_t k = 0; k < order.size(); k++) {
+		FPL_DUPE_ENTRY *de = &dupe_list[order[k]];
+		const char     *name = &dupe_strs[de->fname];
+		const char     *codec = escape_cached(de->codec_ofz,ESCMODE_SQL,esccodec,64);
+		bool            first = (k == 0 || dupe_list[order[k-1]].group != de->group);
+
+		if(first) groups++;
+
+		if(outfile == NULL) {
+			if(first) printf("group %u:\n",groups);
+			printf("  %s (%s, %u kbps, %u bytes, %.2fs)\n",name,codec,de->bitrate,de->fsize,de->duration);
+			continue;
+		}
+
+		escape_str((char*)name,escname,1024);
+		ob_put_uint(groups);
+		ob_write(",\"",2);
+		ob_puts(escname);
+		ob_write("\",\"",3);
+		ob_puts(codec);
+		ob_write("\",",2);
+		ob_put_uint(de->bitrate);
+		ob_write(",",1);
+		ob_put_uint(de->fsize);
+		ob_write(",",1);
+		ob_put_fixed(de->duration,2);
+		ob_write("\n",1);
+	}
+
+	printf("dupes: %u groups, %u tracks (of %u compared)\n",groups,(unsigned int)order.size(),(unsigned int)dupe_list.size());
+}
+
+int dupes_output(FILE *outfile, char *trackfile, int listlen) {
+
+	double durationdub;
+	int    kept_artist = 0, kept_title = 0;
+
+	if(listlen == -1) {
+		dupe_report(outfile);
+		dupe_list.clear();
+		dupe_strs.clear();
+		return 150;
+	}
+
+	// tracks without both an artist and a title can't be matched
+	unsigned long long name = dupe_hash(get_attrib((char*)"artist",listlen),14695981039346656037ULL,false,&kept_artist);
+	name = (name ^ 0xFF) * 1099511628211ULL;	// separator
+	name = dupe_hash(get_attrib((char*)"title",listlen),name,true,&kept_title);
+	if(!kept_artist || !kept_title) return 0;
+
+	memcpy((void*)&durationdub,chunkrunner.duration_dbl,8);
+	if(!std::isfinite(durationdub)) return 0;	// would break the duration sort
+
+	FPL_DUPE_ENTRY de;
+
+	de.name      = name;
+	de.duration  = durationdub;
+	de.group     = -1;
+	de.fname     = dupe_strs.size();
+	de.codec_ofz = get_attrib_ofz((char*)"codec",listlen);
+	de.bitrate   = (unsigned int)typed_attrib("bitrate",listlen,TYPED_INT)->value;
+	de.fsize     = chunkrunner.fsize;
+	dupe_strs.insert(dupe_strs.end(),trackfile,trackfile + strlen(trackfile) + 1);
+	dupe_list.push_back(de);
+
+	return 0;
+}
+
+
+/*
+
+Shared-memory export (-shm)
+
+The decoded playlist is published as a named POSIX shared-memory segment that
+another process on the same host can map and read in place. Everything is
+native-endian and the layout is fixed (see README):
+
+	FPL_SHM_HEADER				64 bytes, at offset 0
+	FPL_SHM_TRACK[track_count]	80 bytes each, at track_ofz
+	FPL_SHM_ATTRIB[attrib_count]	8 bytes each, at attrib_ofz
+	string blob					at strings_ofz: a copy of the playlist's string
+								table, followed by any remapped filenames
+
+All strings are referenced by their byte offset into the blob and are NUL
+terminated. Tracks are collected while the playlist is read; the segment is
+built in one go at the end. An existing segment of the same name is unlinked
+first, so readers that still have it mapped keep a consistent old copy, and the
+magic is written last.
+
+*/
+
+#ifndef _WIN32
+
+// write the segment; returns non-zero on failure
+static int shm_publish() {
+
+	size_t track_ofz   = sizeof(FPL_SHM_HEADER);
+	size_t attrib_ofz  = track_ofz + sizeof(FPL_SHM_TRACK) * shm_tracks.size();
+	size_t strings_ofz = attrib_ofz + sizeof(FPL_SHM_ATTRIB) * shm_attribs.size();
+	size_t strings_sz  = data_sz + shm_extra.size();
+	size_t total_sz    = strings_ofz + strings_sz;
+
+	shm_unlink(shm_name);
+
+	int fd = shm_open(shm_name,O_CREAT | O_EXCL | O_RDWR,0644);
+	if(fd < 0) {
+		printf("shm: unable to create \"%s\": %s\n",shm_name,strerror(errno));
+		return 1;
+	}
+
+	if(ftruncate(fd,(off_t)total_sz)) {
+		printf("shm: unable to size \"%s\": %s\n",shm_name,strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	char *seg = (char*)mmap(NULL,total_sz,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+	close(fd);
+	if(seg == (char*)MAP_FAILED) {
+		printf("shm: unable to map \"%s\": %s\n",shm_name,strerror(errno));
+		return 1;
+	}
+
+	FPL_SHM_HEADER *hdr = (FPL_SHM_HEADER*)seg;
+	memset(hdr,0,sizeof(FPL_SHM_HEADER));
+	hdr->version      = FPLSHM_VERSION;
+	hdr->track_size   = sizeof(FPL_SHM_TRACK);
+	hdr->track_count  = (unsigned int)shm_tracks.size();
+	hdr->attrib_count = (unsigned int)shm_attribs.size();
+	hdr->track_ofz    = track_ofz;
+	hdr->attrib_ofz   = attrib_ofz;
+	hdr->strings_ofz  = strings_ofz;
+	hdr->strings_sz   = strings_sz;
+	hdr->total_sz     = total_sz;
+
+	if(shm_tracks.size())  memcpy(seg + track_ofz,&shm_tracks[0],sizeof(FPL_SHM_TRACK) * shm_tracks.size());
+	if(shm_attribs.size()) memcpy(seg + attrib_ofz,&shm_attribs[0],sizeof(FPL_SHM_ATTRIB) * shm_attribs.size());
+	memcpy(seg + strings_ofz,dataprime,data_sz);
+	if(shm_extra.size())   memcpy(seg + strings_ofz + data_sz,&shm_extra[0],shm_extra.size());
+
+	// readers check the magic: publish it only once everything else is in place
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(hdr->magic,FPLSHM_MAGIC,8);
+
+	munmap(seg,total_sz);
+
+	printf("shm: published %u tracks, %u attributes (%lu bytes) as \"%s\"\n",
+	       (unsigned int)shm_tracks.size(),(unsigned int)shm_attribs.size(),(unsigned long)total_sz,shm_name);
+
+	return 0;
+}
+
+#endif // _WIN32
+
+int shm_output(FILE *outfile, char *trackfile, int listlen) {
+
+	FPL_SHM_TRACK st;
+	double        durationdub;
+
+	if(listlen == -1) {
+#ifndef _WIN32
+		if(!shm_failed && shm_publish()) shm_failed = true;
+#endif
+		shm_tracks.clear();
+		shm_attribs.clear();
+		shm_extra.clear();
+		return 150;
+	}
+
+	memset(&st,0,sizeof(st));
+	memcpy((void*)&durationdub,chunkrunner.duration_dbl,8);
+
+	// rewritten filenames aren't in the string table: append them after it
+	if(strcmp(trackfile,dataprime + chunkrunner.file_ofz)) {
+		st.filename = data_sz + (unsigned int)shm_extra.size();
+		shm_extra.insert(shm_extra.end(),trackfile,trackfile + strlen(trackfile) + 1);
+	} else {
+		st.filename = chunkrunner.file_ofz;
+	}
+
+	st.subsong      = chunkrunner.subsong;
+	st.fsize        = chunkrunner.fsize;
+	st.attrib_first = (unsigned int)shm_attribs.size();
+	st.attrib_count = listlen;
+	st.duration     = durationdub;
+	st.rpg_album    = chunkrunner.rpg_album;
+	st.rpg_track    = chunkrunner.rpg_track;
+	st.rpk_album    = chunkrunner.rpk_album;
+	st.rpk_track    = chunkrunner.rpk_track;
+
+	for(int ii = 0; ii < listlen; ii++) {
+		FPL_SHM_ATTRIB sa;
+		sa.name  = (unsigned int)(trackrunner[ii].field_name - dataprime);
+		sa.value = trackrunner[ii].value_ofz;
+		shm_attribs.push_back(sa);
+		if(trackrunner[ii].key != -1) st.primary_count++;
+	}
+
+	// typed_attrib's result only lives until the next lookup
+	const FPL_TYPED *tv;
+	if((tv = typed_attrib("tracknumber",listlen,TYPED_NUMBER))->valid) {
+		st.tracknumber = (unsigned int)tv->value;
+		st.typed |= FPLSHM_HAS_TRACKNUMBER;
+		if(tv->disc) {
+			st.discnumber = tv->disc;
+			st.typed |= FPLSHM_HAS_DISCNUMBER;
+		}
+	}
+	if((tv = typed_attrib("discnumber",listlen,TYPED_NUMBER))->valid) {
+		st.discnumber = (unsigned int)tv->value;
+		st.typed |= FPLSHM_HAS_DISCNUMBER;
+	}
+	if((tv = typed_attrib("date",listlen,TYPED_DATE))->valid) {
+		st.timestamp = tv->value;
+		st.typed |= FPLSHM_HAS_TIMESTAMP;
+	}
+	if((tv = typed_attrib("bitrate",listlen,TYPED_INT))->valid) {
+		st.bitrate = (unsigned int)tv->value;
+		st.typed |= FPLSHM_HAS_BITRATE;
+	}
+	if((tv = typed_attrib("samplerate",listlen,TYPED_INT))->valid) {
+		st.samplerate = (unsigned int)tv->value;
+		st.typed |= FPLSHM_HAS_SAMPLERATE;
+	}
 
+	shm_tracks.push_back(st);
 
 	return 0;
 }